@@ -0,0 +1,121 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Resident flash agent, for the Cortex-M algorithms built with FLASH_AGENT
+ *  defined. A FlashPrg.c includes it after its entry points.
+ *
+ *  RunAgent is called once like any other entry point, but it does not
+ *  return after one operation. It takes the commands the host writes into
+ *  AgentQueue (FlashOS.h) while the core keeps running, and runs them
+ *  through the entry points of the algorithm, so there is no halt and
+ *  resume per page and the flash stays unlocked between the commands.
+ *
+ *   host:   fills slot[head % AGENT_SLOTS], then increments head, at most
+ *           AGENT_SLOTS commands ahead of tail
+ *   agent:  runs the command, writes its result and increments tail
+ *
+ *  A result is valid once tail has passed its command, until the host
+ *  writes the slot again. A failed command counts in errors and the agent
+ *  goes on with the next one. AGENT_STOP ends RunAgent at the breakpoint,
+ *  it returns 0 if no command failed.
+ *
+ *  AGENT_WAIT() is called while the queue is empty, e.g. to feed a
+ *  watchdog.
+ */
+
+#ifndef AGENT_WAIT
+#define AGENT_WAIT()
+#endif
+
+volatile struct AgentQueue AgentQueue;
+
+/*
+ *  Run one command through its entry point
+ *    Parameter:      pCmd:  Command, result is written back
+ *    Return Value:   1 - OK,  0 - Failed
+ */
+static int agentCommand (volatile struct AgentCommand* pCmd) {
+  unsigned long adr = pCmd->adr;
+  unsigned long sz = pCmd->sz;
+  unsigned long r;
+  int ok;
+
+  switch (pCmd->cmd) {
+    case AGENT_ERASESECTOR:
+      r = EraseSector(adr);
+      ok = (r == 0);
+      break;
+    case AGENT_ERASECHIP:
+      r = EraseChip();
+      ok = (r == 0);
+      break;
+    case AGENT_ERASERANGE:
+      r = EraseRange(adr, sz);
+      ok = (r == 0);
+      break;
+    case AGENT_PROGRAM:
+      r = ProgramPage(adr, sz, (unsigned char*)pCmd->buf);
+      ok = (r == 0);
+      break;
+    case AGENT_VERIFY:
+      r = Verify(adr, sz, (unsigned char*)pCmd->buf);
+      ok = (r == adr + sz);
+      break;
+    case AGENT_BLANKCHECK:
+      r = BlankCheck(adr, sz, (unsigned char)pCmd->buf);
+      ok = (r == 0);
+      break;
+    case AGENT_CRC:
+      r = ComputeCRC(adr, sz);
+      ok = 1;
+      break;
+    default:
+      r = 1;                                 // Unknown Command
+      ok = 0;
+      break;
+  }
+  pCmd->result = r;
+  return (ok);
+}
+
+/*
+ *  Run the queued commands until AGENT_STOP
+ *    Return Value:   0 - OK,  1 - a Command failed
+ */
+int RunAgent (void) {
+  volatile struct AgentCommand* pCmd;
+
+  AgentQueue.errors = 0;
+  AgentQueue.state = AGENT_RUNNING;
+  for (;;) {
+    if (AgentQueue.tail == AgentQueue.head) {
+      AGENT_WAIT();
+      continue;
+    }
+    pCmd = &AgentQueue.slot[AgentQueue.tail & (AGENT_SLOTS - 1)];
+    if (pCmd->cmd == AGENT_STOP) {
+      break;
+    }
+    if (!agentCommand(pCmd)) {
+      AgentQueue.errors++;
+    }
+    AgentQueue.tail++;
+  }
+  AgentQueue.tail++;
+  AgentQueue.state = AGENT_STOPPED;
+  return (AgentQueue.errors != 0);
+}
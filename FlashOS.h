@@ -67,3 +67,145 @@ extern          int  ProgramPage (unsigned long adr,   // Program Page Function
 extern unsigned long Verify      (unsigned long adr,   // Verify Function
                                   unsigned long sz,
                                   unsigned char *buf);
+
+// Error Codes: the Functions above return 1 on a Failure, or one of these
+// where the Algorithm can tell the Cause. Any non-zero Value is a Failure.
+#define FLASH_ERR_FAILED     1     // Operation failed
+#define FLASH_ERR_TIMEOUT    2     // Flash still busy after the Time Out
+#define FLASH_ERR_PROTECTED  3     // Write or Erase Protection
+
+// Flash Programming Extensions (Called by host tools)
+extern unsigned long ComputeCRC  (unsigned long adr,   // CRC-32 (IEEE 802.3)
+                                  unsigned long sz);   //  of a Flash Region
+
+// Pipelined Programming: ProgramPageStart keeps its state in the PageStatus
+// block in algorithm RAM. The host does not wait for the breakpoint, it reads
+// PageStatus over the debug port while the core runs and fills its other
+// buffer meanwhile. There is no status call, the core is busy until the Page
+// is done, so a call could only ever return PAGE_DONE or PAGE_FAILED.
+#define PAGE_IDLE      0       // No Page started yet
+#define PAGE_BUSY      1       // Page is being programmed
+#define PAGE_DONE      2       // Page programmed without Errors
+#define PAGE_FAILED    3       // Page programming failed
+
+struct PageStatus  {
+  unsigned long      state;    // PAGE_IDLE, PAGE_BUSY, PAGE_DONE, PAGE_FAILED
+  unsigned long        adr;    // Flash Address of the started Page
+  unsigned long        buf;    // RAM Buffer being programmed
+};
+
+extern          int  ProgramPageStart  (unsigned long adr,   // Start Program Page
+                                        unsigned long sz,
+                                        unsigned char *buf);
+
+// Background Erase: EraseSectorStart and EraseChipStart return once the Erase
+// runs, the host polls EraseProgress until it is done and meanwhile is free
+// to load Buffers. EraseStatus in algorithm RAM holds the last State.
+#define ERASE_IDLE     0       // No Erase started yet
+#define ERASE_BUSY     1       // Erase running
+#define ERASE_DONE     2       // Erase finished without Errors
+#define ERASE_FAILED   3       // Erase failed, Error Code in result
+
+struct EraseStatus  {
+  unsigned long      state;    // ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+  unsigned long        adr;    // Sector Address, Device Address for a Chip Erase
+  unsigned long     result;    // Error Code of a failed Erase
+  unsigned long    timeout;    // Time Out in ms, checked by the host
+  unsigned long       done;    // Erase Steps finished
+  unsigned long      total;    // Erase Steps, 1 unless the Algorithm splits the Erase
+};
+
+extern          int  EraseSectorStart  (unsigned long adr);  // Start Erase Sector
+extern          int  EraseChipStart    (void);               // Start Erase complete Device
+extern          int  EraseProgress     (void);               // State of the started Erase
+
+extern          int  EraseRange        (unsigned long start, // Erase Sectors in Range
+                                        unsigned long size);
+
+extern          int  ProgramPageLZ4    (unsigned long adr,   // Program LZ4 compressed
+                                        unsigned long sz,    //  Data, sz is the
+                                        unsigned char *buf); //  compressed Size
+
+extern          int  ProgramDelta      (unsigned long adr,   // Rebuild changed Sectors
+                                        unsigned long sz,    //  from Delta Ops against
+                                        unsigned char *buf); //  the current Contents
+
+extern          int  ProgramPageUpdate (unsigned long adr,   // Program in place when
+                                        unsigned long sz,    //  the Flash allows it,
+                                        unsigned char *buf); //  else erase and program
+
+// Resident Agent: Algorithms built with FLASH_AGENT defined export RunAgent,
+// which stays in a Loop and runs the Commands the host writes into the
+// AgentQueue Ring in algorithm RAM, until it reads AGENT_STOP
+#define AGENT_SLOTS          8     // Commands in the Ring, a Power of 2
+
+#define AGENT_STOP           0     // Return from RunAgent
+#define AGENT_ERASESECTOR    1     // EraseSector (adr)
+#define AGENT_ERASECHIP      2     // EraseChip ()
+#define AGENT_ERASERANGE     3     // EraseRange (adr, sz)
+#define AGENT_PROGRAM        4     // ProgramPage (adr, sz, buf)
+#define AGENT_VERIFY         5     // Verify (adr, sz, buf)
+#define AGENT_BLANKCHECK     6     // BlankCheck (adr, sz, buf = Pattern)
+#define AGENT_CRC            7     // ComputeCRC (adr, sz)
+
+#define AGENT_STOPPED        0     // AgentQueue.state
+#define AGENT_RUNNING        1
+
+struct AgentCommand  {
+  unsigned long        cmd;    // AGENT_STOP, AGENT_ERASESECTOR, ...
+  unsigned long        adr;    // Arguments of the Entry Point
+  unsigned long         sz;
+  unsigned long        buf;
+  unsigned long     result;    // Return Value, valid once tail has passed
+};
+
+struct AgentQueue  {
+  unsigned long      state;    // AGENT_STOPPED, AGENT_RUNNING
+  unsigned long       head;    // Commands written, only the host writes it
+  unsigned long       tail;    // Commands done, only the agent writes it
+  unsigned long     errors;    // Failed Commands since RunAgent
+  struct AgentCommand slot[AGENT_SLOTS];  // Command n in slot[n % AGENT_SLOTS]
+};
+
+extern          int  RunAgent          (void);               // Run queued Commands
+
+// Statistics: Algorithms built with FLASH_STATS defined count into the
+// FlashStats block in algorithm RAM, cleared by Init, read by the host
+#define STATS_VERSION        1
+#define STATS_INIT           0     // Entry Point Indices of FlashStats.entry
+#define STATS_UNINIT         1
+#define STATS_ERASECHIP      2
+#define STATS_ERASESECTOR    3
+#define STATS_PROGRAMPAGE    4
+#define STATS_VERIFY         5
+#define STATS_BLANKCHECK     6
+#define STATS_COMPUTECRC     7
+#define STATS_PROGRAMSTART   8
+#define STATS_ERASERANGE     9
+#define STATS_PROGRAMLZ4     10
+#define STATS_PROGRAMDELTA   11
+#define STATS_PROGRAMUPDATE  12
+#define STATS_PROGRAMDUAL    13
+#define STATS_ERASESECTORSTART 14
+#define STATS_ERASECHIPSTART 15
+#define STATS_ENTRIES        16
+
+struct FlashStatsEntry  {
+  unsigned long      calls;    // Calls since Init
+  unsigned long     cycles;    // Core Cycles in the Entry Point, nested Calls included
+};
+
+struct FlashStats  {
+  unsigned long    version;    // STATS_VERSION
+  unsigned long  busyPolls;    // Status Polls while the Flash was busy
+  unsigned long busyCycles;    // Core Cycles waiting for the Flash
+  unsigned long    written;    // Bytes written to the Flash
+  unsigned long    skipped;    // Bytes skipped, erased in Data and Flash
+  struct FlashStatsEntry entry[STATS_ENTRIES];
+};
+
+// Family specific Extensions
+extern          int  SetParallelism    (unsigned long psize);  // STM32F4: x8/x16/x32/x64
+extern          int  ProgramPageDual   (unsigned long adr,   // STM32L4: Program a Page,
+                                        unsigned long sz,    //  verify the previous one
+                                        unsigned char *buf); //  in the other Bank
@@ -1,3 +1,5 @@
+#include "../FlashOS.h"
+
 #define uint8_t     unsigned char
 #define uint16_t    unsigned short
 #define uint32_t    unsigned long
@@ -58,6 +60,87 @@
 #define FLASH_UNLOCK_KEY1      0x45670123
 #define FLASH_UNLOCK_KEY2      0xCDEF89AB
 
+/*********************************************************************
+*
+*      FLASH layout: 1 KB pages
+*/
+#define FLASH_PAGE_SIZE        0x400
+
+/*********************************************************************
+*
+*      time outs in mcycle counts at the highest core clock, a slower
+*      clock only makes them longer. Constants, rv32i has no multiply.
+*/
+#define CORE_CLK_MAX           108000000
+#define TIMEOUT_PROG           (CORE_CLK_MAX / 1000)           // halfword, 1 ms
+#define ERASE_MS               500                             // page
+#define MASS_ERASE_MS          10000                           // below 2^32 cycles
+#define TIMEOUT_ERASE          (CORE_CLK_MAX / 1000 * ERASE_MS)
+#define TIMEOUT_MASS_ERASE     (CORE_CLK_MAX / 1000 * MASS_ERASE_MS)
+
+/*********************************************************************
+*
+*      FLASH device start address
+*/
+#define FLASH_BASE             0x08000000
+
+
+/*
+ *  halfwords skipped by program() since init because the data and the
+ *  flash both hold the erased value, read by the host for statistics
+ */
+volatile uint32_t skippedUnits = 0;
+
+
+/*********************************************************************
+*
+*      CRC-32 (IEEE 802.3) lookup table, reflected polynomial 0xEDB88320
+*/
+static const uint32_t crcTable[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
 
 
 
@@ -74,6 +157,136 @@ int unlockFlash(void) {
 
 
 
+/*
+ *  Read the low word of the cycle counter, wraps after 39 s at 108 MHz
+ */
+static uint32_t cycles (void) {
+    uint32_t c;
+
+    __asm volatile("csrr %0, mcycle\n" : "=r" (c));
+    return c;
+}
+
+/*
+ *  Statistics, built with FLASH_STATS defined: cycles of each entry
+ *  point, busy polls and bytes in flashStats (struct FlashStats)
+ */
+#ifdef FLASH_STATS
+volatile struct FlashStats flashStats;
+static uint32_t statsStart[STATS_ENTRIES];
+
+static void statsClear (void) {
+    uint32_t i;
+
+    flashStats.busyPolls = flashStats.busyCycles = 0;
+    flashStats.written = flashStats.skipped = 0;
+    for (i = 0; i < STATS_ENTRIES; i++)
+    {
+        flashStats.entry[i].calls = flashStats.entry[i].cycles = 0;
+    }
+    flashStats.version = STATS_VERSION;
+}
+
+#define STATS_CLEAR()          statsClear()
+#define STATS_ENTER(e)         (flashStats.entry[e].calls++, statsStart[e] = cycles())
+#define STATS_LEAVE(e)         (flashStats.entry[e].cycles += cycles() - statsStart[e])
+#define STATS_ADD(field, n)    (flashStats.field += (n))
+#else
+#define STATS_CLEAR()
+#define STATS_ENTER(e)
+#define STATS_LEAVE(e)
+#define STATS_ADD(field, n)
+#endif
+
+/*
+ *  Wait for BSY cleared
+ *    Parameter:      timeout:  cycles
+ *                    sr:       set to the last state register value
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int waitBusy (uint32_t timeout, uint32_t *sr) {
+    uint32_t start = cycles();
+    int result = 0;
+
+    while (((*sr = FMC_STAT_REG) & FLASH_STAT_BSY) == FLASH_STAT_BSY)
+    {
+        STATS_ADD(busyPolls, 1);
+        if ((cycles() - start) >= timeout)
+        {
+            result = FLASH_ERR_TIMEOUT;
+            break;
+        }
+    }
+    STATS_ADD(busyCycles, cycles() - start);
+    return result;
+}
+
+/*
+ *  Error code of the state register after an operation, clears the flags
+ *    Return Value:   0 - OK,  FLASH_ERR_PROTECTED,  FLASH_ERR_FAILED
+ */
+static int errorCode (uint32_t sr) {
+    FMC_STAT_REG = sr & (FLASH_STAT_PGERR | FLASH_STAT_WRPRTERR | FLASH_STAT_ENDF);
+    if ((sr & FLASH_STAT_WRPRTERR) != 0)
+    {
+        return FLASH_ERR_PROTECTED;
+    }
+    return ((sr & FLASH_STAT_PGERR) != 0) ? FLASH_ERR_FAILED : 0;
+}
+
+/*
+ *  State of the erase started by eraseSectorStart or eraseChipStart
+ */
+static volatile struct EraseStatus eraseStatus = { ERASE_IDLE, 0, 0, 0, 0, 1 };
+static uint32_t eraseBits = 0;              // CTL bits of the started erase
+
+/*
+ *  End the started erase once BSY is cleared, clears its CTL bits and flags
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+static int eraseCheck (void) {
+    uint32_t sr;
+
+    if (eraseStatus.state != ERASE_BUSY)
+    {
+        return eraseStatus.state;
+    }
+    sr = FMC_STAT_REG;
+    if ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY)
+    {
+        return ERASE_BUSY;
+    }
+    FMC_CTL_REG &= ~eraseBits;
+    eraseStatus.result = errorCode(sr);
+    eraseStatus.done = 1;
+    eraseStatus.state = (eraseStatus.result == 0) ? ERASE_DONE : ERASE_FAILED;
+    return eraseStatus.state;
+}
+
+/*
+ *  Unlock if locked and wait for an operation still running, an erase
+ *  started before is ended first
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int begin (void) {
+    uint32_t sr = 0;
+
+    /* check flash is locked, if yes, unlock it */
+    if ((FMC_CTL_REG & FLASH_CTL_LOCK) == FLASH_CTL_LOCK)
+    {
+        unlockFlash();
+    }
+    /* wait SR BSY cleared */
+    if (waitBusy(TIMEOUT_ERASE, &sr) != 0)
+    {
+        return FLASH_ERR_TIMEOUT;
+    }
+    eraseCheck();
+    /* flags of earlier operations */
+    FMC_STAT_REG = FLASH_STAT_PGERR | FLASH_STAT_WRPRTERR | FLASH_STAT_ENDF;
+    return 0;
+}
+
 /*
  *  Initialize Flash Programming Functions
  *    Parameter:      addr:  Device Base Address
@@ -85,7 +298,13 @@ int init (unsigned long addr) {
     //
     /* clear error, disable interrupt */
     FMC_STAT_REG = FLASH_STAT_PGERR | FLASH_STAT_WRPRTERR | FLASH_STAT_ENDF;
+    skippedUnits = 0;
+    /* run mcycle for the time outs, clear mcountinhibit.CY */
+    __asm volatile("csrci 0x320, 1\n");
+    STATS_CLEAR();
+    STATS_ENTER(STATS_INIT);
     
+    STATS_LEAVE(STATS_INIT);
     __asm volatile("mv a0, x0\n");
     __asm volatile("ebreak\n");
     return (0);
@@ -97,33 +316,31 @@ int init (unsigned long addr) {
  */
 
 int unInit (void) {
+    STATS_ENTER(STATS_UNINIT);
     //
     // No special uninit necessary
     //
+    STATS_LEAVE(STATS_UNINIT);
     __asm volatile("mv a0, x0\n");
     __asm volatile("ebreak\n");
     return (0);
 }
 
 /*
- *  Erase complete Flash Memory
- *    Return Value:   0 - OK,  1 - Failed
+ *  Mass erase, called by eraseChip and the agent
+ *    Return Value:   0 - OK,  error code
  */
-int eraseChip (void) {
+static int massErase (void) {
 
     uint32_t cr = 0;
     uint32_t sr = 0;
-    
-    /* check flash is locked, if yes, unlock it */
-    cr = FMC_CTL_REG;
-    if ((cr & FLASH_CTL_LOCK) == FLASH_CTL_LOCK)
+    int result;
+
+    result = begin();
+    if (result != 0)
     {
-        unlockFlash();
+        return result;
     }
-    /* wait SR BSY cleared */
-    do {
-        sr = FMC_STAT_REG;
-    } while ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);
     
     /* first set MER bit, then set START bit */
     cr = FMC_CTL_REG;
@@ -135,38 +352,48 @@ int eraseChip (void) {
     FMC_CTL_REG = cr;
     
     /* wait SR BSY cleared */
-    do {
-        sr = FMC_STAT_REG;
-    } while ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);
+    result = waitBusy(TIMEOUT_MASS_ERASE, &sr);
 
     /* clear MER bit */
     cr = FMC_CTL_REG;
     cr &= ~FLASH_CTL_MER;
     FMC_CTL_REG = cr;
-    
-    __asm volatile("mv a0, x0\n");
-    __asm volatile("ebreak\n");
-    return (0);                                    // Finished without Errors
+
+    return (result != 0) ? result : errorCode(sr);
 }
 
 /*
- *  Erase Sector in Flash Memory
+ *  Erase complete Flash Memory
+ *    Return Value:   0 - OK,  error code
+ */
+int eraseChip (void) {
+    int result;
+
+    STATS_ENTER(STATS_ERASECHIP);
+
+    result = massErase();
+
+    STATS_LEAVE(STATS_ERASECHIP);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Erase a page, called by eraseSector and eraseRange
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
-int eraseSector (unsigned long adr) {
+static int erase (unsigned long adr) {
     uint32_t cr = 0;
     uint32_t sr = 0;
-    /* check flash is locked, if yes, unlock it */
-    cr = FMC_CTL_REG;
-    if ((cr & FLASH_CTL_LOCK) == FLASH_CTL_LOCK)
+    int result;
+
+    result = begin();
+    if (result != 0)
     {
-        unlockFlash();
+        return result;
     }
-    /* wait SR BSY cleared */
-    do {
-        sr = FMC_STAT_REG;
-    } while ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);    
     
     /* first set PER bit, then set address, last set STRT bit */
     cr = FMC_CTL_REG;
@@ -181,73 +408,208 @@ int eraseSector (unsigned long adr) {
     FMC_CTL_REG = cr;    
     
     /* wait SR BSY cleared */
-    do {
-        sr = FMC_STAT_REG;
-    } while ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);
+    result = waitBusy(TIMEOUT_ERASE, &sr);
 
     /* clear PER bit */
     cr = FMC_CTL_REG;
     cr &= ~FLASH_CTL_PER;
     FMC_CTL_REG = cr;    
 
-    __asm volatile("mv a0, x0\n");
-    __asm volatile("ebreak\n");
-    return (0);
+    return (result != 0) ? result : errorCode(sr);
 }
 
 /*
- *  Program Page in Flash Memory
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  error code
+ */
+int eraseSector (unsigned long adr) {
+    int result;
+
+    STATS_ENTER(STATS_ERASESECTOR);
+
+    result = erase(adr);
+
+    STATS_LEAVE(STATS_ERASESECTOR);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Start an erase and return while it runs
+ *    Parameter:      adr:   Sector Address, FLASH_BASE for a mass erase
+ *                    bits:  FLASH_CTL_PER or FLASH_CTL_MER
+ *                    ms:    time out, checked by the host
+ *    Return Value:   0 - started,  error code
+ */
+static int eraseStart (unsigned long adr, uint32_t bits, uint32_t ms) {
+    int result;
+
+    result = begin();
+
+    eraseStatus.adr = adr;
+    eraseStatus.timeout = ms;
+    eraseStatus.result = result;
+    eraseStatus.done = 0;
+    eraseStatus.total = 1;
+    if (result != 0)
+    {
+        eraseStatus.state = ERASE_FAILED;
+        return result;
+    }
+
+    /* first set PER or MER bit, then set address, last set START bit */
+    FMC_CTL_REG |= bits;
+    if (bits == FLASH_CTL_PER)
+    {
+        FMC_ADDR_REG = adr;
+    }
+    eraseBits = bits;
+    eraseStatus.state = ERASE_BUSY;
+    FMC_CTL_REG |= FLASH_CTL_START;
+    return 0;
+}
+
+/*
+ *  Start erasing a Sector, background mode
+ *   returns once the erase runs, the host polls eraseProgress
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - started,  error code
+ */
+int eraseSectorStart (unsigned long adr) {
+    int result;
+
+    STATS_ENTER(STATS_ERASESECTORSTART);
+
+    result = eraseStart(adr, FLASH_CTL_PER, ERASE_MS);
+
+    STATS_LEAVE(STATS_ERASESECTORSTART);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Start erasing the complete Flash Memory, background mode
+ *    Return Value:   0 - started,  error code
+ */
+int eraseChipStart (void) {
+    int result;
+
+    STATS_ENTER(STATS_ERASECHIPSTART);
+
+    result = eraseStart(FLASH_BASE, FLASH_CTL_MER, MASS_ERASE_MS);
+
+    STATS_LEAVE(STATS_ERASECHIPSTART);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  State of the erase started last, ends it once the flash is ready
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+int eraseProgress (void) {
+    int state;
+
+    state = eraseCheck();
+
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (state) : "a0");
+    return state;
+}
+
+/*
+ *  Erase the pages overlapping a range, called by eraseRange and the agent
+ *    Parameter:      start:  Start Address
+ *                    size:   Size (in bytes)
+ *    Return Value:   0 - OK,  error code
+ */
+static int erasePages (unsigned long start, unsigned long size) {
+    uint32_t adr;
+    int result = 0;
+
+    adr = start & ~(FLASH_PAGE_SIZE - 1);
+    while ((adr < start + size) && (result == 0))
+    {
+        result = erase(adr);
+        adr += FLASH_PAGE_SIZE;
+    }
+    return result;
+}
+
+/*
+ *  Erase all pages overlapping a range of Flash Memory
+ *    Parameter:      start:  Start Address
+ *                    size:   Size (in bytes)
+ *    Return Value:   0 - OK,  error code
+ */
+int eraseRange (unsigned long start, unsigned long size) {
+    int result;
+
+    STATS_ENTER(STATS_ERASERANGE);
+
+    result = erasePages(start, size);
+
+    STATS_LEAVE(STATS_ERASERANGE);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Program flash, called by programPage and programPageStart
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
-int programPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
+static int program (unsigned long adr, unsigned long sz, unsigned char *buf) {
     volatile uint16_t * pDest;
     volatile uint16_t * pSrc;
     uint32_t cr = 0;
     uint32_t sr = 0;
     uint32_t i = 0;
     uint16_t data;
+    int result;
     
     pDest = (volatile uint16_t *)adr;
     pSrc  = (volatile uint16_t *)buf;    // Always 32-bit aligned. Made sure by CMSIS-DAP firmware
 
-    /* check flash is locked, if yes, unlock it */
-    cr = FMC_CTL_REG;
-    if ((cr & FLASH_CTL_LOCK) == FLASH_CTL_LOCK)
-    {
-        unlockFlash();
-    }
-    /* wait SR BSY cleared */
-    do {
-        sr = FMC_STAT_REG;
-    } while ((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);    
+    result = begin();
 
-    while (i < sz/2 )
+    while ((i < sz/2) && (result == 0))
     {
+        /* an erased halfword needs no write, no BSY wait and no readback */
+        if ((*pSrc == 0xFFFF) && (*pDest == 0xFFFF))
+        {
+            skippedUnits++;
+            STATS_ADD(skipped, 2);
+            pDest++;
+            pSrc++;
+            i++;
+            continue;
+        }
         /* first set PG bit in CR, then write data to flash address */
         cr = FMC_CTL_REG;
         cr |= FLASH_CTL_PG;
         FMC_CTL_REG = cr;
         
         *pDest = *pSrc;
+        STATS_ADD(written, 2);
         /* wait SR BSY cleared */
-        do {
-            sr = FMC_STAT_REG;
-        } while((sr & FLASH_STAT_BSY) == FLASH_STAT_BSY);
+        result = waitBusy(TIMEOUT_PROG, &sr);
         
-        /* check program word is ok */
-        if (*pSrc != *pDest)
+        /* stop at the first error flag, check program word is ok */
+        if (result == 0)
         {
-            /* clear PG bit */
-            cr = FMC_CTL_REG;
-            cr &= ~FLASH_CTL_PG;
-            FMC_CTL_REG = cr;    
-            
-            __asm volatile("li a0, 0x01\n");
-            __asm volatile("ebreak\n");
-            return 1;
+            result = errorCode(sr);
+        }
+        if ((result == 0) && (*pSrc != *pDest))
+        {
+            result = FLASH_ERR_FAILED;
         }
         pDest++;
         pSrc++;
@@ -259,7 +621,470 @@ int programPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
     cr &= ~FLASH_CTL_PG;
     FMC_CTL_REG = cr;
     
-    __asm volatile("mv a0, x0\n");
-    __asm volatile("ebreak\n");
-    return (0);
+    return result;
+}
+
+/*
+ *  Program Page in Flash Memory
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  error code
+ */
+int programPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
+    int result;
+
+    STATS_ENTER(STATS_PROGRAMPAGE);
+
+    result = program(adr, sz, buf);
+
+    STATS_LEAVE(STATS_PROGRAMPAGE);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Compare flash and data, called by verify and the agent
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+static unsigned long verifyData (unsigned long adr, unsigned long sz, const unsigned char *buf) {
+    const uint32_t * pDest;
+    const uint32_t * pSrc;
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    pDest = (const uint32_t *)adr;
+    pSrc  = (const uint32_t *)buf;
+
+    /* compare word by word when both sides are 32-bit aligned */
+    if (((adr | (uint32_t)buf) & 3) == 0)
+    {
+        n = sz >> 2;
+    }
+    /* 4 words per loop */
+    while ((i + 4) <= n)
+    {
+        if ((pDest[i]     != pSrc[i])     || (pDest[i + 1] != pSrc[i + 1]) ||
+            (pDest[i + 2] != pSrc[i + 2]) || (pDest[i + 3] != pSrc[i + 3]))
+        {
+            break;
+        }
+        i += 4;
+    }
+    while (i < n)
+    {
+        if (pDest[i] != pSrc[i])
+        {
+            break;
+        }
+        i++;
+    }
+    /* locate the failed byte, compare the tail */
+    for (i <<= 2; i < sz; i++)
+    {
+        if (((const uint8_t *)adr)[i] != buf[i])
+        {
+            break;
+        }
+    }
+
+    return (adr + i);
+}
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+unsigned long verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+    unsigned long result;
+
+    STATS_ENTER(STATS_VERIFY);
+
+    result = verifyData(adr, sz, buf);
+
+    STATS_LEAVE(STATS_VERIFY);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  Check a block for a pattern, called by blankCheck and the agent
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+static int blankData (unsigned long adr, unsigned long sz, unsigned char pat) {
+    const uint32_t * pDest;
+    uint32_t pattern;
+    int result = 0;
+
+    /* replicate pattern byte into a word, rv32i has no multiply */
+    pattern = pat | ((uint32_t)pat << 8);
+    pattern |= pattern << 16;
+
+    /* leading bytes up to word alignment */
+    while ((sz != 0) && ((adr & 3) != 0) && (result == 0))
+    {
+        if (*(const uint8_t *)adr != pat)
+        {
+            result = 1;
+        }
+        adr++;
+        sz--;
+    }
+    /* aligned words, stop at first non blank word */
+    pDest = (const uint32_t *)adr;
+    while ((sz >= 4) && (result == 0))
+    {
+        if (*pDest != pattern)
+        {
+            result = 1;
+        }
+        pDest++;
+        sz -= 4;
+    }
+    /* trailing bytes */
+    adr = (unsigned long)pDest;
+    while ((sz != 0) && (result == 0))
+    {
+        if (*(const uint8_t *)adr != pat)
+        {
+            result = 1;
+        }
+        adr++;
+        sz--;
+    }
+
+    return result;
+}
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int blankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+    int result;
+
+    STATS_ENTER(STATS_BLANKCHECK);
+
+    result = blankData(adr, sz, pat);
+
+    STATS_LEAVE(STATS_BLANKCHECK);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  CRC-32 of a flash region, called by computeCRC and the agent
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+static uint32_t crcData (unsigned long adr, unsigned long sz) {
+    const uint32_t * pSrc;
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    pSrc = (const uint32_t *)adr;
+    if ((adr & 3) == 0)
+    {
+        n = sz >> 2;
+    }
+    /* one word load, 4 table lookups */
+    while (i < n)
+    {
+        crc ^= pSrc[i];
+        crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+        crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+        crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+        crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+        i++;
+    }
+    /* remaining bytes */
+    for (i <<= 2; i < sz; i++)
+    {
+        crc = (crc >> 8) ^ crcTable[(crc ^ ((const uint8_t *)adr)[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long computeCRC (unsigned long adr, unsigned long sz) {
+    uint32_t crc;
+
+    STATS_ENTER(STATS_COMPUTECRC);
+
+    crc = crcData(adr, sz);
+
+    STATS_LEAVE(STATS_COMPUTECRC);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (crc) : "a0");
+    return crc;
+}
+
+/*
+ *  State of the page started by programPageStart, polled by the host
+ *  over the debug port while the core is running
+ */
+volatile struct PageStatus pageStatus = { PAGE_IDLE, 0, 0 };
+
+/*
+ *  Start programming a Page, pipelined mode
+ *   the host does not wait for the call to return, it loads the next page
+ *   into its second buffer while this one is written and polls pageStatus
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int programPageStart (unsigned long adr, unsigned long sz, unsigned char *buf) {
+    int result;
+
+    STATS_ENTER(STATS_PROGRAMSTART);
+
+    pageStatus.adr = adr;
+    pageStatus.buf = (unsigned long)buf;
+    pageStatus.state = PAGE_BUSY;
+
+    result = program(adr, sz, buf);
+
+    pageStatus.state = (result == 0) ? PAGE_DONE : PAGE_FAILED;
+
+    STATS_LEAVE(STATS_PROGRAMSTART);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+/*
+ *  LZ4 decompression buffer, programmed with program() when full
+ */
+#define LZ4_CHUNK           256             // decompressed bytes per program()
+#define LZ4_PAD             2               // last chunk is padded to halfwords
+#define LZ4_EMPTY           0xFF            // content of erased flash
+
+static uint32_t lz4Words[LZ4_CHUNK / 4];   // word aligned for program()
+#define lz4Buf ((uint8_t *)lz4Words)
+static uint32_t lz4Adr;                     // flash address of lz4Buf[0]
+static uint32_t lz4Fill;                    // bytes in lz4Buf
+
+const uint32_t lz4ChunkSize = LZ4_CHUNK;
+
+static int lz4Out (uint8_t b) {
+    lz4Buf[lz4Fill++] = b;
+    if (lz4Fill < LZ4_CHUNK) {
+        return 0;
+    }
+    lz4Fill = 0;
+    lz4Adr += LZ4_CHUNK;
+    return program(lz4Adr - LZ4_CHUNK, LZ4_CHUNK, lz4Buf);
+}
+
+/*
+ *  Decompress LZ4 sequences into flash, called by programPageLZ4
+ */
+static int lz4Program (unsigned long adr, unsigned long sz, unsigned char *buf) {
+    const uint8_t *in = buf;
+    const uint8_t *end = buf + sz;
+    uint32_t len, off;
+    uint8_t token, b;
+
+    lz4Adr = adr;
+    lz4Fill = 0;
+    while (in < end) {
+        /* literals */
+        token = *in++;
+        len = token >> 4;
+        if (len == 15) {
+            do {
+                if (in == end) {
+                    return 1;               // truncated stream
+                }
+                b = *in++;
+                len += b;
+            } while (b == 255);
+        }
+        if (len > (uint32_t)(end - in)) {
+            return 1;                       // truncated stream
+        }
+        for (; len != 0; len--) {
+            if (lz4Out(*in++) != 0) {
+                return 1;
+            }
+        }
+        if (in == end) {
+            break;                          // last sequence, no match
+        }
+        /* match, copied from lz4Buf or from flash */
+        if ((end - in) < 2) {
+            return 1;
+        }
+        off = in[0] | (in[1] << 8);
+        in += 2;
+        len = token & 15;
+        if (len == 15) {
+            do {
+                if (in == end) {
+                    return 1;               // truncated stream
+                }
+                b = *in++;
+                len += b;
+            } while (b == 255);
+        }
+        if (off == 0) {
+            continue;
+        }
+        for (len += 4; len != 0; len--) {
+            b = (off <= lz4Fill) ? lz4Buf[lz4Fill - off] : *(const uint8_t *)(lz4Adr - (off - lz4Fill));
+            if (lz4Out(b) != 0) {
+                return 1;
+            }
+        }
+    }
+    if (lz4Fill == 0) {
+        return 0;
+    }
+    while ((lz4Fill % LZ4_PAD) != 0) {
+        lz4Buf[lz4Fill++] = LZ4_EMPTY;
+    }
+    return program(lz4Adr, lz4Fill, lz4Buf);
+}
+
+/*
+ *  Program LZ4 compressed data
+ *   buf holds LZ4 block sequences, a sequence with offset 0 has no match
+ *   so the host can cut a stream after any sequence. Matches may reach
+ *   back into flash programmed before, by this or an earlier call.
+ *    Parameter:      adr:  Start Address of the decompressed data
+ *                    sz:   Size of the compressed data
+ *                    buf:  Compressed data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int programPageLZ4 (unsigned long adr, unsigned long sz, unsigned char *buf) {
+    int result;
+
+    STATS_ENTER(STATS_PROGRAMLZ4);
+
+    result = lz4Program(adr, sz, buf);
+
+    STATS_LEAVE(STATS_PROGRAMLZ4);
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
+}
+
+#ifdef FLASH_AGENT
+/*
+ *  Resident agent, built with FLASH_AGENT defined: runAgent runs the
+ *  commands the host writes into agentQueue (struct AgentQueue) without
+ *  an ebreak between them, see FlashAgent.h for the protocol. The static
+ *  routines are called directly, the entry points would stop at ebreak.
+ */
+volatile struct AgentQueue agentQueue;
+
+/*
+ *  Run one command
+ *    Parameter:      cmd:  Command, result is written back
+ *    Return Value:   1 - OK,  0 - Failed
+ */
+static int agentCommand (volatile struct AgentCommand *cmd) {
+    unsigned long adr = cmd->adr;
+    unsigned long sz = cmd->sz;
+    unsigned long result;
+    int ok;
+
+    switch (cmd->cmd)
+    {
+        case AGENT_ERASESECTOR:
+            result = erase(adr);
+            ok = (result == 0);
+            break;
+        case AGENT_ERASECHIP:
+            result = massErase();
+            ok = (result == 0);
+            break;
+        case AGENT_ERASERANGE:
+            result = erasePages(adr, sz);
+            ok = (result == 0);
+            break;
+        case AGENT_PROGRAM:
+            result = program(adr, sz, (unsigned char *)cmd->buf);
+            ok = (result == 0);
+            break;
+        case AGENT_VERIFY:
+            result = verifyData(adr, sz, (const unsigned char *)cmd->buf);
+            ok = (result == adr + sz);
+            break;
+        case AGENT_BLANKCHECK:
+            result = blankData(adr, sz, (unsigned char)cmd->buf);
+            ok = (result == 0);
+            break;
+        case AGENT_CRC:
+            result = crcData(adr, sz);
+            ok = 1;
+            break;
+        default:
+            /* unknown command */
+            result = 1;
+            ok = 0;
+            break;
+    }
+    cmd->result = result;
+    return ok;
+}
+
+/*
+ *  Run the queued commands until AGENT_STOP
+ *    Return Value:   0 - OK,  1 - a command failed
+ */
+int runAgent (void) {
+    volatile struct AgentCommand *cmd;
+    int result;
+
+    agentQueue.errors = 0;
+    agentQueue.state = AGENT_RUNNING;
+    for (;;)
+    {
+        if (agentQueue.tail == agentQueue.head)
+        {
+            continue;
+        }
+        cmd = &agentQueue.slot[agentQueue.tail & (AGENT_SLOTS - 1)];
+        if (cmd->cmd == AGENT_STOP)
+        {
+            break;
+        }
+        if (!agentCommand(cmd))
+        {
+            agentQueue.errors++;
+        }
+        agentQueue.tail++;
+    }
+    agentQueue.tail++;
+    agentQueue.state = AGENT_STOPPED;
+    result = (agentQueue.errors != 0);
+
+    __asm volatile("mv a0, %0\n"
+                   "ebreak\n" : : "r" (result) : "a0");
+    return result;
 }
+#endif
@@ -22,10 +22,13 @@ struct FlashDevice const FlashDevice  =  {
    ONCHIP,                     // Device Type
    0x00000000,                 // Flash start address
    0x00010000,                 // Flash total size (64 KB )
-   256,                        // Programming Page Size
+   1024,                       // Programming Page Size, with the algorithm
+                               // (5 KB code, 1.5 KB data, 384 B stack) and
+                               // the 0x20 header it fits the 8 KB SRAM less
+                               // the 32 bytes of IAP
    0,                          // Reserved, must be 0
    0xFF,                       // Initial Content of Erased Memory
-   300,                        // Program Page Timeout 300 mSec
+   1000,                       // Program Page Timeout 1000 mSec
    3000,                       // Erase Sector Timeout 3000 mSec
 // Specify Size and Address of Sectors
   0x00001000, 0x000000,        // Sector Size  4 KB (16 Sectors)
@@ -17,6 +17,11 @@
 #include "FlashOS.H"        // FlashOS Structures
 
 #define LPC11U35_END_SECTOR     15      // 64/4 = 16
+#define LPC11U35_TO_ERASE       3000    // Erase Sector Time Out in ms, toErase in FlashDev.c
+
+#ifndef LPC11U35_USE_PLL
+#define LPC11U35_USE_PLL        1       // 1: IAP at 48MHz (System PLL), 0: 12MHz IRC
+#endif
 
 // Memory Mapping Control
 #define MEMMAP     (*((volatile unsigned char *) 0x40048000))
@@ -25,8 +30,34 @@
 #define MAINCLKSEL (*((volatile unsigned long *) 0x40048070))
 #define MAINCLKUEN (*((volatile unsigned long *) 0x40048074))
 #define MAINCLKDIV (*((volatile unsigned long *) 0x40048078))
-      
+
+// System PLL
+#define SYSPLLCTRL   (*((volatile unsigned long *) 0x40048008))
+#define SYSPLLSTAT   (*((volatile unsigned long *) 0x4004800C))
+#define SYSPLLCLKSEL (*((volatile unsigned long *) 0x40048040))
+#define SYSPLLCLKUEN (*((volatile unsigned long *) 0x40048044))
+#define PDRUNCFG     (*((volatile unsigned long *) 0x40048238))
+#define PDRUNCFG_SYSPLL_PD  0x00000080
+
+// Flash Access Time
+#define FLASHCFG     (*((volatile unsigned long *) 0x4003C010))
+#define FLASHTIM_MSK 0x00000003
+
+#if LPC11U35_USE_PLL
+#define CCLK        (48000)    // 48MHz System PLL, 12MHz IRC x 4
+#define FLASHTIM    2          // 3 System Clocks Flash Access Time (<= 50MHz)
+#else
 #define CCLK        (12000)    // 12MHz Internal RC Oscillator
+#define FLASHTIM    0          // 1 System Clock Flash Access Time (<= 20MHz)
+#endif
+
+#if LPC11U35_USE_PLL                           // restored by UnInit
+static unsigned long flashtim;                  // FLASHTIM of the Application
+static unsigned long flashtim_saved;            // flashtim holds it
+#endif
+
+#define IAP_BLOCK_MAX 4096     // Largest Copy RAM to Flash Block
+#define IAP_BLOCK_MIN 256      // Smallest Copy RAM to Flash Block
 
 typedef struct {                  // IAP Structure
   unsigned long cmd;           // Command
@@ -36,11 +67,139 @@ typedef struct {                  // IAP Structure
 } iap_t;
 
 
+/* CRC-32 (IEEE 802.3) Table, reflected Polynomial 0xEDB88320 */
+static const unsigned long crc_table[256] = {
+  0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+  0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+  0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+  0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+  0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+  0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+  0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+  0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+  0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+  0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+  0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+  0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+  0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+  0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+  0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+  0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+  0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+  0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+  0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+  0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+  0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+  0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+  0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+  0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+  0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+  0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+  0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+  0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+  0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+  0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+  0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+  0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+  0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+  0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+  0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+  0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+  0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+  0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+  0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+  0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+  0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+  0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+  0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+
 /* IAP Call */
 typedef void (*IAP_Entry) (unsigned long *cmd, unsigned long *stat);
 #define IAP_Call ((IAP_Entry) 0x1FFF1FF1)
 
 
+/* Statistics (FLASH_STATS), cycles counted with SysTick */
+#ifdef FLASH_STATS
+#define SYST_CSR   (*((volatile unsigned long *) 0xE000E010))
+#define SYST_RVR   (*((volatile unsigned long *) 0xE000E014))
+#define SYST_CVR   (*((volatile unsigned long *) 0xE000E018))
+#define SYST_MAX   0x00FFFFFF  // 349 ms at 48MHz, a longer IAP Call is undercounted
+
+volatile struct FlashStats FlashStats;
+static unsigned long stats_last;               // SysTick at the last Sample
+static unsigned long stats_total;              // Cycles since Init
+static unsigned long stats_start[STATS_ENTRIES];
+static unsigned long stats_saved;              // SysTick of the Application saved
+static unsigned long stats_csr;                // its Control and Status
+static unsigned long stats_rvr;                // its Reload Value
+
+static unsigned long stats_clock (void) {
+  unsigned long now = SYST_CVR;
+
+  stats_total += (stats_last - now) & SYST_MAX;
+  stats_last   = now;
+  return (stats_total);
+}
+
+static void stats_clear (void) {
+  unsigned long i;
+
+  if (!stats_saved) {                          // once, Init may come twice
+    stats_csr   = SYST_CSR & 7;
+    stats_rvr   = SYST_RVR;
+    stats_saved = 1;
+  }
+  SYST_CSR = 0;
+  SYST_RVR = SYST_MAX;
+  SYST_CVR = 0;
+  SYST_CSR = 5;                                // Core Clock, enabled
+  stats_last  = SYST_CVR;
+  stats_total = 0;
+  FlashStats.busyPolls = FlashStats.busyCycles = 0;
+  FlashStats.written   = FlashStats.skipped    = 0;
+  for (i = 0; i < STATS_ENTRIES; i++) {
+    FlashStats.entry[i].calls = FlashStats.entry[i].cycles = 0;
+  }
+  FlashStats.version = STATS_VERSION;
+}
+
+static void stats_enter (unsigned long entry) {
+  FlashStats.entry[entry].calls++;
+  stats_start[entry] = stats_clock();
+}
+
+static unsigned long stats_leave (unsigned long entry, unsigned long result) {
+  FlashStats.entry[entry].cycles += stats_clock() - stats_start[entry];
+  return (result);
+}
+
+/* SysTick back to the Application, restarted from its Reload Value */
+static void stats_restore (void) {
+  if (stats_saved) {
+    SYST_CSR = 0;
+    SYST_RVR = stats_rvr;
+    SYST_CVR = 0;
+    SYST_CSR = stats_csr;
+    stats_saved = 0;
+  }
+}
+
+#define STATS_CLEAR()          stats_clear()
+#define STATS_RESTORE()        stats_restore()
+#define STATS_ENTER(entry)     stats_enter(entry)
+#define STATS_LEAVE(entry, r)  stats_leave(entry, r)
+#define STATS_ADD(field, n)    (FlashStats.field += (n))
+#else
+#define STATS_CLEAR()
+#define STATS_RESTORE()
+#define STATS_ENTER(entry)
+#define STATS_LEAVE(entry, r)  (r)
+#define STATS_ADD(field, n)
+#endif
+
+
 /*
  * Get Sector Number
  *    Parameter:      adr:  Sector Address
@@ -55,6 +214,31 @@ unsigned long GetSecNum (unsigned long adr) {
   return (n);                                  // Sector Number
 }
 
+/*
+ *  Prepare and Erase a Range of Sectors
+ *    Parameter:      n0:   Start Sector
+ *                    n1:   End Sector
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+static int erase_sectors (unsigned long n0, unsigned long n1) {
+  iap_t IAP;
+
+  IAP.cmd    = 50;                             // Prepare Sector for Erase
+  IAP.par[0] = n0;                             // Start Sector
+  IAP.par[1] = n1;                             // End Sector
+  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
+  if (IAP.stat) return (1);                    // Command Failed
+
+  IAP.cmd    = 52;                             // Erase Sector
+  IAP.par[0] = n0;                             // Start Sector
+  IAP.par[1] = n1;                             // End Sector
+  IAP.par[2] = CCLK;                           // CCLK in kHz
+  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
+  if (IAP.stat) return (1);                    // Command Failed
+
+  return (0);                                  // Finished without Errors
+}
+
 /*
  *  Initialize Flash Programming Functions
  *    Parameter:      adr:  Device Base Address
@@ -71,9 +255,33 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
 //  while (!(MAINCLKUEN & 1));                   // Wait until updated
   MAINCLKDIV = 1;                              // Set Main Clock divider to 1
 
+#if LPC11U35_USE_PLL
+  if (!flashtim_saved) {                       // once, Init may come twice
+    flashtim       = FLASHCFG & FLASHTIM_MSK;
+    flashtim_saved = 1;
+  }
+  FLASHCFG   = (FLASHCFG & ~FLASHTIM_MSK) | FLASHTIM;  // before raising CCLK
+
+  PDRUNCFG  |=  PDRUNCFG_SYSPLL_PD;            // Power down PLL to change it
+  SYSPLLCLKSEL = 0;                            // PLL Input: Internal RC
+  SYSPLLCLKUEN = 1;                            // Update PLL Clock Source
+  SYSPLLCLKUEN = 0;                            // Toggle Update Register
+  SYSPLLCLKUEN = 1;
+  SYSPLLCTRL = 0x23;                           // M = 4, P = 2: FCCO 192MHz
+  PDRUNCFG  &= ~PDRUNCFG_SYSPLL_PD;            // Power up PLL
+  while (!(SYSPLLSTAT & 1));                   // Wait for PLL Lock
+
+  MAINCLKSEL = 3;                              // Select PLL Output
+  MAINCLKUEN = 1;                              // Update Main Clock Source
+  MAINCLKUEN = 0;                              // Toggle Update Register
+  MAINCLKUEN = 1;
+#endif
+
   MEMMAP     = 0x02;                           // User Flash Mode
 
-  return (0);
+  STATS_CLEAR();
+  STATS_ENTER(STATS_INIT);
+  return (STATS_LEAVE(STATS_INIT, 0));
 }
 
 /*
@@ -82,7 +290,25 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  *    Return Value:   0 - OK,  1 - Failed
  */
 int UnInit (unsigned long fnc) {
-  return (0);
+  int result;
+
+  STATS_ENTER(STATS_UNINIT);
+
+#if LPC11U35_USE_PLL
+  MAINCLKSEL = 0;                              // Back to Internal RC Oscillator
+  MAINCLKUEN = 1;                              // Update Main Clock Source
+  MAINCLKUEN = 0;                              // Toggle Update Register
+  MAINCLKUEN = 1;
+  PDRUNCFG  |= PDRUNCFG_SYSPLL_PD;             // Power down PLL
+  if (flashtim_saved) {                        // after lowering CCLK
+    FLASHCFG = (FLASHCFG & ~FLASHTIM_MSK) | flashtim;
+    flashtim_saved = 0;
+  }
+#endif
+
+  result = STATS_LEAVE(STATS_UNINIT, 0);
+  STATS_RESTORE();                             // after the last Sample
+  return (result);
 }
 
 /*
@@ -90,21 +316,10 @@ int UnInit (unsigned long fnc) {
  *    Return Value:   0 - OK,  1 - Failed
  */
 int EraseChip (void) {
-  iap_t IAP;
-  IAP.cmd    = 50;                             // Prepare Sector for Erase
-  IAP.par[0] = 0;                              // Start Sector
-  IAP.par[1] = LPC11U35_END_SECTOR;            // End Sector
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
 
-  IAP.cmd    = 52;                             // Erase Sector
-  IAP.par[0] = 0;                              // Start Sector
-  IAP.par[1] = LPC11U35_END_SECTOR;            // End Sector
-  IAP.par[2] = CCLK;                           // CCLK in kHz
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
+  STATS_ENTER(STATS_ERASECHIP);
 
-  return (0);                                  // Finished without Errors
+  return (STATS_LEAVE(STATS_ERASECHIP, erase_sectors(0, LPC11U35_END_SECTOR)));
 }
 
 /*
@@ -114,60 +329,363 @@ int EraseChip (void) {
  */
 int EraseSector (unsigned long adr) {
   unsigned long n;
-  iap_t IAP;
+
+  STATS_ENTER(STATS_ERASESECTOR);
     
   n = GetSecNum(adr);                          // Get Sector Number
 
-  IAP.cmd    = 50;                             // Prepare Sector for Erase
-  IAP.par[0] = n;                              // Start Sector
-  IAP.par[1] = n;                              // End Sector
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
-
-  IAP.cmd    = 52;                             // Erase Sector
-  IAP.par[0] = n;                              // Start Sector
-  IAP.par[1] = n;                              // End Sector
-  IAP.par[2] = CCLK;                           // CCLK in kHz
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
-
-  return (0);                                  // Finished without Errors
+  return (STATS_LEAVE(STATS_ERASESECTOR, erase_sectors(n, n)));
 }
 
 /*
  *  Program Page in Flash Memory
+ *   the page is written with the largest IAP blocks (4096/1024/512/256)
+ *   that fit its alignment, one prepare/copy/compare sequence per block
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
  *    Return Value:   0 - OK,  1 - Failed
  */
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-  unsigned long n;
+  unsigned long n, blk;
   iap_t IAP;
 
+  STATS_ENTER(STATS_PROGRAMPAGE);
+
+  if (adr & (IAP_BLOCK_MIN - 1)) return (STATS_LEAVE(STATS_PROGRAMPAGE, 1)); // IAP needs 256 Byte alignment
+  sz = (sz / IAP_BLOCK_MIN) * IAP_BLOCK_MIN;   // Whole 256 Byte Blocks only
+
+  while (sz) {
+    blk = IAP_BLOCK_MAX;                       // Largest Block that fits
+    while ((blk > sz) || (adr & (blk - 1))) {
+      blk >>= (blk == IAP_BLOCK_MAX) ? 2 : 1;  // 4096, 1024, 512, 256
+    }
+    n = GetSecNum(adr);                        // Get Sector Number
+
+    IAP.cmd    = 50;                           // Prepare Sector for Write
+    IAP.par[0] = n;                            // Start Sector
+    IAP.par[1] = n;                            // End Sector
+    IAP_Call (&IAP.cmd, &IAP.stat);            // Call IAP Command
+    if (IAP.stat) return (STATS_LEAVE(STATS_PROGRAMPAGE, 1)); // Command Failed
+
+    IAP.cmd    = 51;                           // Copy RAM to Flash
+    IAP.par[0] = adr;                          // Destination Flash Address
+    IAP.par[1] = (unsigned long)buf;           // Source RAM Address
+    IAP.par[2] = blk;                          // Block Size: 256/512/1024/4096
+    IAP.par[3] = CCLK;                         // CCLK in kHz
+    IAP_Call (&IAP.cmd, &IAP.stat);            // Call IAP Command
+    if (IAP.stat) return (STATS_LEAVE(STATS_PROGRAMPAGE, 1)); // Command Failed
+
+    IAP.cmd    = 56;                           // compare
+    IAP.par[0] = adr;                          // Destination Flash Address
+    IAP.par[1] = (unsigned long)buf;           // Source RAM Address
+    IAP.par[2] = blk;                          // Block Size: 256/512/1024/4096
+    IAP.par[3] = CCLK;                         // CCLK in kHz
+    IAP_Call (&IAP.cmd, &IAP.stat);            // Call IAP Command
+    if (IAP.stat) return (STATS_LEAVE(STATS_PROGRAMPAGE, 1)); // Command Failed
+
+    STATS_ADD(written, blk);
+    adr += blk;                                // Next Block
+    buf += blk;
+    sz  -= blk;
+  }
+
+  return (STATS_LEAVE(STATS_PROGRAMPAGE, 0));    // Finished without Errors
+}
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  const unsigned long *pDest = (const unsigned long *)adr;
+  const unsigned long *pSrc  = (const unsigned long *)buf;
+  unsigned long n, i;
+
+  STATS_ENTER(STATS_VERIFY);
+
+  n = ((adr | (unsigned long)buf) & 3) ? 0 : (sz >> 2);  // Words to compare
+  for (i = 0; (i + 4) <= n; i += 4) {                   // 4 words per loop
+    if ((pDest[i]     != pSrc[i])     || (pDest[i + 1] != pSrc[i + 1]) ||
+        (pDest[i + 2] != pSrc[i + 2]) || (pDest[i + 3] != pSrc[i + 3])) break;
+  }
+  for (; i < n; i++) {                                  // Locate failed word
+    if (pDest[i] != pSrc[i]) break;
+  }
+  for (i <<= 2; i < sz; i++) {                          // Failed byte / tail
+    if (((const unsigned char *)adr)[i] != buf[i]) break;
+  }
+
+  return (STATS_LEAVE(STATS_VERIFY, adr + i));   // Finished
+}
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+  const unsigned long *pDest;
+  unsigned long pattern;
+
+  STATS_ENTER(STATS_BLANKCHECK);
+
+  pattern  = pat | ((unsigned long)pat << 8);  // Replicate Pattern Byte
+  pattern |= pattern << 16;
+
+  for (; sz && (adr & 3); adr++, sz--) {       // Leading Bytes
+    if (*(const unsigned char *)adr != pat) return (STATS_LEAVE(STATS_BLANKCHECK, 1));
+  }
+  for (pDest = (const unsigned long *)adr; sz >= 4; pDest++, sz -= 4) {
+    if (*pDest != pattern) return (STATS_LEAVE(STATS_BLANKCHECK, 1)); // Aligned Words
+  }
+  for (adr = (unsigned long)pDest; sz; adr++, sz--) {
+    if (*(const unsigned char *)adr != pat) return (STATS_LEAVE(STATS_BLANKCHECK, 1)); // Trailing Bytes
+  }
+
+  return (STATS_LEAVE(STATS_BLANKCHECK, 0));     // Memory is blank
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long ComputeCRC (unsigned long adr, unsigned long sz) {
+  const unsigned long *pSrc = (const unsigned long *)adr;
+  unsigned long crc = 0xFFFFFFFF;
+  unsigned long n, i;
+
+  STATS_ENTER(STATS_COMPUTECRC);
+
+  n = (adr & 3) ? 0 : (sz >> 2);               // Words to process
+  for (i = 0; i < n; i++) {                    // 1 Load, 4 Table Lookups
+    crc ^= pSrc[i];
+    crc  = (crc >> 8) ^ crc_table[crc & 0xFF];
+    crc  = (crc >> 8) ^ crc_table[crc & 0xFF];
+    crc  = (crc >> 8) ^ crc_table[crc & 0xFF];
+    crc  = (crc >> 8) ^ crc_table[crc & 0xFF];
+  }
+  for (i <<= 2; i < sz; i++) {                 // Remaining Bytes
+    crc = (crc >> 8) ^ crc_table[(crc ^ ((const unsigned char *)adr)[i]) & 0xFF];
+  }
+
+  return (STATS_LEAVE(STATS_COMPUTECRC, ~crc));
+}
+
+/*
+ *  State of the page started by ProgramPageStart, polled by the host
+ *  over the debug port while the core is running
+ */
+volatile struct PageStatus PageStatus = { PAGE_IDLE, 0, 0 };
+
+/*
+ *  Start programming a Page, pipelined mode
+ *   the host does not wait for the call to return, it loads the next page
+ *   into its second buffer while this one is written and polls PageStatus
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageStart (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  int r;
+
+  STATS_ENTER(STATS_PROGRAMSTART);
+
+  PageStatus.adr   = adr;
+  PageStatus.buf   = (unsigned long)buf;
+  PageStatus.state = PAGE_BUSY;
+  r = ProgramPage(adr, sz, buf);               // Copy RAM to Flash + Compare
+  PageStatus.state = (r == 0) ? PAGE_DONE : PAGE_FAILED;
+
+  return (STATS_LEAVE(STATS_PROGRAMSTART, r));
+}
+
+/*
+ *  State of the erase started by EraseSectorStart or EraseChipStart.
+ *  IAP does not return before an erase is done, so a chip erase is split
+ *  into one sector per EraseProgress call and done counts the sectors
+ */
+volatile struct EraseStatus EraseStatus = { ERASE_IDLE, 0, 0, 0, 0, 1 };
+
+/*
+ *  Erase a Sector, background mode
+ *   IAP erases the sector before the call returns, EraseProgress then
+ *   reports it done
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int EraseSectorStart (unsigned long adr) {
+  unsigned long n;
+  int r;
+
+  STATS_ENTER(STATS_ERASESECTORSTART);
+
   n = GetSecNum(adr);                          // Get Sector Number
+  EraseStatus.adr     = adr;
+  EraseStatus.timeout = LPC11U35_TO_ERASE;
+  EraseStatus.done    = 0;
+  EraseStatus.total   = 1;
+  EraseStatus.state   = ERASE_BUSY;
+  r = erase_sectors(n, n);
+  EraseStatus.result  = r;
+  EraseStatus.done    = (r == 0) ? 1 : 0;
+  EraseStatus.state   = (r == 0) ? ERASE_DONE : ERASE_FAILED;
 
-  IAP.cmd    = 50;                             // Prepare Sector for Write
-  IAP.par[0] = n;                              // Start Sector
-  IAP.par[1] = n;                              // End Sector
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
+  return (STATS_LEAVE(STATS_ERASESECTORSTART, r));
+}
 
-  IAP.cmd    = 51;                             // Copy RAM to Flash
-  IAP.par[0] = adr;                            // Destination Flash Address
-  IAP.par[1] = (unsigned long)buf;             // Source RAM Address
-  IAP.par[2] = (sz / 256) * 256;               // Fixed Page Size: 256/512/1024/4096  
-  IAP.par[3] = CCLK;                           // CCLK in kHz
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
+/*
+ *  Start erasing the complete Flash Memory, background mode
+ *   the sectors are erased by the following EraseProgress calls
+ *    Return Value:   0 - OK
+ */
+int EraseChipStart (void) {
 
-  IAP.cmd    = 56;                             // compare
-  IAP.par[0] = adr;                            // Destination Flash Address
-  IAP.par[1] = (unsigned long)buf;             // Source RAM Address
-  IAP.par[2] = (sz / 256) * 256;               // Fixed Page Size: 256/512/1024/4096  
-  IAP.par[3] = CCLK;                           // CCLK in kHz
-  IAP_Call (&IAP.cmd, &IAP.stat);              // Call IAP Command
-  if (IAP.stat) return (1);                    // Command Failed
-  
-  return (0);                                  // Finished without Errors
+  STATS_ENTER(STATS_ERASECHIPSTART);
+
+  EraseStatus.adr     = 0;
+  EraseStatus.timeout = LPC11U35_TO_ERASE * (LPC11U35_END_SECTOR + 1);
+  EraseStatus.result  = 0;
+  EraseStatus.done    = 0;
+  EraseStatus.total   = LPC11U35_END_SECTOR + 1;
+  EraseStatus.state   = ERASE_BUSY;
+
+  return (STATS_LEAVE(STATS_ERASECHIPSTART, 0));
 }
+
+/*
+ *  State of the erase started last, erases the next sector of a chip erase
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+int EraseProgress (void) {
+  int r;
+
+  if (EraseStatus.state == ERASE_BUSY) {
+    r = erase_sectors(EraseStatus.done, EraseStatus.done);
+    if (r) {
+      EraseStatus.result = r;
+      EraseStatus.state  = ERASE_FAILED;
+    } else if (++EraseStatus.done == EraseStatus.total) {
+      EraseStatus.state  = ERASE_DONE;
+    }
+  }
+  return (EraseStatus.state);
+}
+
+/*
+ *  Erase all Sectors overlapping a Range of Flash Memory
+ *   IAP prepares and erases the whole sector range in one command each
+ *    Parameter:      start:  Start Address
+ *                    size:   Size (in bytes)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int EraseRange (unsigned long start, unsigned long size) {
+  unsigned long n0, n1;
+
+  STATS_ENTER(STATS_ERASERANGE);
+
+  if (size == 0) return (STATS_LEAVE(STATS_ERASERANGE, 0)); // Nothing to erase
+  if (size > 0xFFFFFFFF - start) size = 0 - start;  // start + size must not wrap
+  n0 = GetSecNum(start);                       // First Sector
+  n1 = GetSecNum(start + size - 1);            // Last Sector
+  if (n1 > LPC11U35_END_SECTOR) n1 = LPC11U35_END_SECTOR;
+  if (n0 > n1) return (STATS_LEAVE(STATS_ERASERANGE, 1)); // Outside of Flash
+
+  return (STATS_LEAVE(STATS_ERASERANGE, erase_sectors(n0, n1)));
+}
+
+/*
+ *  LZ4 decompression buffer, programmed with ProgramPage when full
+ *   1 KB, so that each chunk is a single IAP block
+ */
+#define LZ4_CHUNK   1024               // Decompressed Bytes per ProgramPage
+#define LZ4_PAD     256                // Smallest IAP Block
+#define LZ4_EMPTY   0xFF               // Initial Content of Erased Memory
+
+static unsigned long lz4_words[LZ4_CHUNK / 4];   // Word aligned for IAP
+#define lz4_buf ((unsigned char *)lz4_words)
+static unsigned long lz4_adr;          // Flash Address of lz4_buf[0]
+static unsigned long lz4_fill;         // Bytes in lz4_buf
+
+const unsigned long LZ4ChunkSize = LZ4_CHUNK;   // read by flash_algo_gen.py
+
+static int lz4_out (unsigned char b) {
+  lz4_buf[lz4_fill++] = b;
+  if (lz4_fill < LZ4_CHUNK) return (0);
+  lz4_fill = 0;
+  lz4_adr += LZ4_CHUNK;
+  return (ProgramPage(lz4_adr - LZ4_CHUNK, LZ4_CHUNK, lz4_buf));
+}
+
+/*
+ *  Program LZ4 compressed Data
+ *   buf holds LZ4 block sequences, a sequence with offset 0 has no match
+ *   so the host can cut a stream after any sequence. Matches may reach
+ *   back into flash programmed before, by this or an earlier call. The
+ *   last chunk is padded with erased bytes to a whole IAP block.
+ *    Parameter:      adr:  Start Address of the decompressed Data
+ *                    sz:   Size of the compressed Data
+ *                    buf:  Compressed Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageLZ4 (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  const unsigned char *in  = buf;
+  const unsigned char *end = buf + sz;
+  unsigned long len, off;
+  unsigned char token, b;
+
+  STATS_ENTER(STATS_PROGRAMLZ4);
+
+  lz4_adr  = adr;
+  lz4_fill = 0;
+  while (in < end) {
+    token = *in++;                             // Literals
+    len = token >> 4;
+    if (len == 15) {
+      do {
+        if (in == end) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated Stream
+        b = *in++; len += b;
+      } while (b == 255);
+    }
+    if (len > (unsigned long)(end - in)) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated Stream
+    for (; len; len--) {
+      if (lz4_out(*in++)) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1));
+    }
+    if (in == end) break;                      // Last Sequence, no Match
+
+    if ((end - in) < 2) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Match
+    off = in[0] | (in[1] << 8);
+    in += 2;
+    len = token & 15;
+    if (len == 15) {
+      do {
+        if (in == end) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated Stream
+        b = *in++; len += b;
+      } while (b == 255);
+    }
+    if (off == 0) continue;
+    for (len += 4; len; len--) {               // from lz4_buf or from Flash
+      b = (off <= lz4_fill) ? lz4_buf[lz4_fill - off]
+                            : *(const unsigned char *)(lz4_adr - (off - lz4_fill));
+      if (lz4_out(b)) return (STATS_LEAVE(STATS_PROGRAMLZ4, 1));
+    }
+  }
+  if (lz4_fill == 0) return (STATS_LEAVE(STATS_PROGRAMLZ4, 0));
+  while (lz4_fill % LZ4_PAD) {
+    lz4_buf[lz4_fill++] = LZ4_EMPTY;
+  }
+
+  return (STATS_LEAVE(STATS_PROGRAMLZ4, ProgramPage(lz4_adr, lz4_fill, lz4_buf)));
+}
+
+#ifdef FLASH_AGENT
+#include "../FlashAgent.h"                     // Resident Agent, after the Entry Points
+#endif
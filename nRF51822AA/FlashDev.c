@@ -15,20 +15,21 @@
  */
 
 #include "FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"       // Flash Layout
 
 struct FlashDevice const FlashDevice  =  {
    FLASH_DRV_VERS,             // Driver Version, do not modify!
    "nRF51822AA 256 KB Flash",  // Device Name
    ONCHIP,                     // Device Type
-   0x00000000,                 // Flash start address
-   0x00040000,                 // Flash total size (256 KB // + 1 kB)
-   4,                          // Programming Page Size
+   FLASH_DEV_ADDR,             // Flash start address
+   FLASH_DEV_SIZE,             // Flash total size (256 KB // + 1 kB)
+   FLASH_DEV_PAGE,             // Programming Page Size
    0,                          // Reserved, must be 0
-   0xFF,                       // Initial Content of Erased Memory
-   100,                        // Program Page Timeout 100 mSec
-   3000,                       // Erase Sector Timeout 3000 mSec
+   FLASH_DEV_EMPTY,            // Initial Content of Erased Memory
+   FLASH_DEV_TO_PROG,          // Program Page Timeout in mSec
+   FLASH_DEV_TO_ERASE,         // Erase Sector Timeout in mSec
 // Specify Size and Address of Sectors
-  0x000400, 0x000000,         // Sector Size  1 KB (256 Sectors)
+  FLASH_SECTORS
 //  0x000400, 0x10001000        // Sector Size  1 KB (1 Sector)
   SECTOR_END                  // Marks end of sector table
 };
@@ -15,6 +15,7 @@
  */
 
 #include "FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"       // Flash Layout
 
 #define U8  unsigned char
 #define U16 unsigned short
@@ -29,6 +30,25 @@
 #define FLASH_MODE_WRITE (1)
 #define FLASH_MODE_ERASE (2)
 
+#define WDT_FEED_WORDS   (32)  // Words programmed between watchdog feeds, ~1.5 ms
+
+#define CLK_DEFAULT      (16000000)  // HFCLK, when Init gets no clock
+#define TIMER_POLLS      (16)  // Ready polls per SysTick sample
+
+/*
+ *  Sector table, same as FlashDevice.sectors in FlashDev.c
+ */
+static const struct FlashSectors _aSectors[] = {
+  FLASH_SECTORS
+  SECTOR_END
+};
+
+/*
+ *  Words skipped by ProgramPage since Init because the data and the
+ *  flash both hold the erased value, the host reads it for statistics
+ */
+volatile U32 SkippedUnits = 0;
+
 /*********************************************************************
 *
 *       Register definitions
@@ -56,6 +76,60 @@
 #define WDT_REG_CONFIG        *((volatile U32*)(WDT_REGS_BASE_ADDR + 0x50C))
 #define WDT_REG_RR0           *((volatile U32*)(WDT_REGS_BASE_ADDR + 0x600))  // 8 registers, each 4 bytes in size
 
+#define SYST_REG_CSR          *((volatile U32*)(0xE000E010))
+#define SYST_REG_RVR          *((volatile U32*)(0xE000E014))
+#define SYST_REG_CVR          *((volatile U32*)(0xE000E018))
+#define SYST_MAX              (0x00FFFFFF)
+
+/*
+ *  CRC-32 (IEEE 802.3) lookup table, reflected polynomial 0xEDB88320
+ */
+static const U32 _aCRCTable[256] = {
+  0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+  0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+  0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+  0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+  0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+  0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+  0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+  0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+  0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+  0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+  0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+  0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+  0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+  0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+  0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+  0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+  0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+  0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+  0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+  0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+  0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+  0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+  0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+  0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+  0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+  0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+  0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+  0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+  0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+  0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+  0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+  0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+  0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+  0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+  0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+  0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+  0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+  0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+  0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+  0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+  0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+  0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+  0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
 /*
  *  Feed watchdog, if running
  */
@@ -79,11 +153,158 @@ static void _FeedWDT(void) {
   }
 }
 
+/*
+ *  Time outs: SysTick runs at the core clock and is sampled while polling
+ *  READY, the budgets come from FlashDev.h. FlashDevice itself is not
+ *  loaded with the algorithm.
+ */
+
+static U32 _TimerKHz = CLK_DEFAULT / 1000;
+static U32 _TimerLast;
+static U32 _TimerTotal;                // Cycles since Init, wraps
+static U32 _TimerMark;                 // _TimerTotal at _TimerStart
+static U32 _TimerSaved;                // 1 - SysTick of the application saved
+static U32 _TimerCSR;                  // Its SYST_CSR and SYST_RVR, restored by UnInit
+static U32 _TimerRVR;
+
+//
+// Saturated at half the counter range, so an elapsed count cannot wrap past it
+//
+static U32 _Cycles(U32 ms) {
+  return (ms < (0x7FFFFFFF / _TimerKHz)) ? ms * _TimerKHz : 0x7FFFFFFF;
+}
+
+static U32 _Clock(void) {
+  U32 Now;
+
+  Now = SYST_REG_CVR;
+  _TimerTotal += (_TimerLast - Now) & SYST_MAX;
+  _TimerLast = Now;
+  return _TimerTotal;
+}
+
+static void _TimerStart(void) {
+  _TimerMark = _Clock();
+}
+
+static U32 _Timer(void) {
+  return _Clock() - _TimerMark;
+}
+
+/*
+ *  Statistics (FLASH_STATS), cycles counted with the time out SysTick
+ */
+#ifdef FLASH_STATS
+volatile struct FlashStats FlashStats;
+static U32 _aStatsStart[STATS_ENTRIES];
+
+static void _StatsClear(void) {
+  U32 i;
+
+  FlashStats.busyPolls = FlashStats.busyCycles = 0;
+  FlashStats.written = FlashStats.skipped = 0;
+  for (i = 0; i < STATS_ENTRIES; i++) {
+    FlashStats.entry[i].calls = FlashStats.entry[i].cycles = 0;
+  }
+  FlashStats.version = STATS_VERSION;
+}
+
+static void _StatsEnter(U32 Entry) {
+  FlashStats.entry[Entry].calls++;
+  _aStatsStart[Entry] = _Clock();
+}
+
+static U32 _StatsLeave(U32 Entry, U32 Result) {
+  FlashStats.entry[Entry].cycles += _Clock() - _aStatsStart[Entry];
+  return Result;
+}
+
+#define STATS_CLEAR()          _StatsClear()
+#define STATS_ENTER(Entry)     _StatsEnter(Entry)
+#define STATS_LEAVE(Entry, r)  _StatsLeave(Entry, r)
+#define STATS_ADD(Field, n)    (FlashStats.Field += (n))
+#else
+#define STATS_CLEAR()
+#define STATS_ENTER(Entry)
+#define STATS_LEAVE(Entry, r)  (r)
+#define STATS_ADD(Field, n)
+#endif
+
+/*
+ *  Wait for the flash controller, the watchdog is fed if FeedWDT is set
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int _WaitReady(U32 Deadline, int FeedWDT) {
+  U32 NumPolls;
+  int r;
+#ifdef FLASH_STATS
+  U32 Start = _Clock();
+#endif
+
+  NumPolls = 0;
+  r = 0;
+  while ((FLASH_REG_READY & 1) == 0) {    // Flash controller busy?
+    if (FeedWDT) {
+      _FeedWDT();
+    }
+    if (((++NumPolls % TIMER_POLLS) == 0) && (_Timer() >= Deadline)) {
+      r = FLASH_ERR_TIMEOUT;
+      break;
+    }
+  }
+#ifdef FLASH_STATS
+  FlashStats.busyPolls += NumPolls;
+  FlashStats.busyCycles += _Clock() - Start;
+#endif
+  return (r);
+}
+
+/*
+ *  State of the erase started by EraseSectorStart or EraseChipStart
+ */
+volatile struct EraseStatus EraseStatus = { ERASE_IDLE, 0, 0, 0, 0, 1 };
+
+/*
+ *  End the started erase once the NVMC is ready, CONFIG must not change
+ *  before. With Wait set it waits up to the time out of the erase
+ */
+static void _EraseCheck(int Wait) {
+  if (EraseStatus.state != ERASE_BUSY) {
+    return;
+  }
+  if (Wait) {
+    _TimerStart();
+    _WaitReady(_Cycles(EraseStatus.timeout), 1);
+  }
+  if (FLASH_REG_READY & 1) {
+    FLASH_REG_CONFIG = FLASH_MODE_READ;
+    EraseStatus.done = 1;
+    EraseStatus.state = ERASE_DONE;
+  }
+}
+
+/*
+ *  Put the NVMC into erase mode for a background erase
+ */
+static void _EraseBegin(U32 Addr, U32 TimeOut) {
+  _EraseCheck(1);
+  EraseStatus.adr = Addr;
+  EraseStatus.timeout = TimeOut;
+  EraseStatus.result = 0;
+  EraseStatus.done = 0;
+  EraseStatus.total = 1;
+  EraseStatus.state = ERASE_BUSY;
+  FLASH_REG_CONFIG = FLASH_MODE_ERASE;
+}
+
 /*
  *  Erase a single flash sector
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
  */
-static void _EraseSector(U32 Addr) {
-  U32 Status;
+static int _EraseSector(U32 Addr) {
+  int r;
+
+  _EraseCheck(1);
   //
   // Make sure that flash controller is in erase mode
   //
@@ -99,17 +320,13 @@ static void _EraseSector(U32 Addr) {
   //
   // Wait for operation to complete
   //
-  do {
-    _FeedWDT();
-    Status = FLASH_REG_READY;
-    if (Status & 1) {        // Flash controller ready?
-      break;
-    }
-  } while(1);
+  _TimerStart();
+  r = _WaitReady(_Cycles(FLASH_DEV_TO_ERASE), 1);
   //
   // Bring back flash controller into read mode
   //
   FLASH_REG_CONFIG = FLASH_MODE_READ;
+  return (r);
 }
 
 /*
@@ -123,7 +340,25 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
 	//
 	// No special init necessary
 	//
-  return (0);
+  SkippedUnits = 0;
+  //
+  // Free running SysTick for the time outs, the setup of the application
+  // is saved first. A second Init without UnInit keeps the saved one
+  //
+  _TimerKHz = (clk ? clk : CLK_DEFAULT) / 1000;
+  if (_TimerSaved == 0) {
+    _TimerCSR = SYST_REG_CSR;
+    _TimerRVR = SYST_REG_RVR;
+    _TimerSaved = 1;
+  }
+  SYST_REG_CSR = 0;
+  SYST_REG_RVR = SYST_MAX;
+  SYST_REG_CVR = 0;
+  SYST_REG_CSR = 5;                 // Core clock, enabled
+  _TimerLast = SYST_REG_CVR;
+  STATS_CLEAR();
+  STATS_ENTER(STATS_INIT);
+  return (STATS_LEAVE(STATS_INIT, 0));
 }
 
 /*
@@ -133,18 +368,33 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
-	//
-	// No special uninit necessary
-	//
-  return (0);
+  int result;
+
+  STATS_ENTER(STATS_UNINIT);
+  result = STATS_LEAVE(STATS_UNINIT, 0);
+  //
+  // SysTick back to the application, restarted from its reload value,
+  // after the last sample
+  //
+  if (_TimerSaved) {
+    SYST_REG_CSR = 0;
+    SYST_REG_RVR = _TimerRVR;
+    SYST_REG_CVR = 0;
+    SYST_REG_CSR = _TimerCSR;
+    _TimerSaved = 0;
+  }
+  return (result);
 }
 
 /*
  *  Erase complete Flash Memory
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseChip (void) {
-  U32 Status;
+  int r;
+
+  STATS_ENTER(STATS_ERASECHIP);
+  _EraseCheck(1);
   //
   // Make sure that flash controller is in erase mode
   //
@@ -157,30 +407,25 @@ int EraseChip (void) {
 	//
 	FLASH_REG_ERASEALL = 1;
 	//
-	// Wait for operation to complete
+	// Wait for operation to complete, CODE and UICR take up to two page erases
 	//
-	do {
-		Status = FLASH_REG_READY;
-		if (Status & 1) {        // Flash controller ready?
-			break;
-		}
-		_FeedWDT();
-	} while(1);
+	_TimerStart();
+	r = _WaitReady(_Cycles(FLASH_DEV_TO_ERASE * 2), 1);
   //
   // Bring back flash controller into read mode
   //
   FLASH_REG_CONFIG = FLASH_MODE_READ;   
-  return (0);                                    // Finished without Errors
+  return (STATS_LEAVE(STATS_ERASECHIP, r));
 }
 
 /*
  *  Erase Sector in Flash Memory
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseSector (unsigned long adr) {
-  _EraseSector(adr);
-  return (0);
+  STATS_ENTER(STATS_ERASESECTOR);
+  return (STATS_LEAVE(STATS_ERASESECTOR, _EraseSector(adr)));
 }
 
 /*
@@ -188,19 +433,25 @@ int EraseSector (unsigned long adr) {
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
   volatile U32* pDest;
   volatile U32* pSrc;
   U32 NumWords;
-  U32 Status;
+  U32 NumBlock;
+  U32 Step;
+  U32 Deadline;
+  int r;
+
+  STATS_ENTER(STATS_PROGRAMPAGE);
+  _EraseCheck(1);
 	
   pDest = (volatile U32*)adr;
   pSrc = (volatile U32*)buf;    // Always 32-bit aligned. Made sure by CMSIS-DAP firmware
 	//
 	// adr is always aligned to "Programming Page Size" specified in table in FlashDev.c
-  // sz is always a multiple of "Programming Page Size"
+  // sz is always a multiple of 4, it may span several flash pages
 	//
   NumWords = sz >> 2;	
   //
@@ -208,24 +459,620 @@ int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
   //
   FLASH_REG_CONFIG = FLASH_MODE_WRITE;
   //
-  // Program word by word
+  // Each word gets its share of the page time out
   //
-  do {
-		*pDest++ = *pSrc++;
-    //
-    // Wait for operation to complete
-    //
+  Step = _Cycles(FLASH_DEV_TO_PROG) / (FLASH_DEV_PAGE >> 2);
+  Deadline = 0;
+  r = 0;
+  _TimerStart();
+  //
+  // Program word by word. The watchdog is fed once per block of words,
+  // so the ready poll of each word is just a load and a branch
+  //
+  while (NumWords && (r == 0)) {
+    _FeedWDT();
+    NumBlock = (NumWords < WDT_FEED_WORDS) ? NumWords : WDT_FEED_WORDS;
+    NumWords -= NumBlock;
     do {
-      Status = FLASH_REG_READY;
-      if (Status & 1) {        // Flash controller ready?
-        break;
+      //
+      // Erased words need no write and no wait
+      //
+      if ((*pSrc == 0xFFFFFFFF) && (*pDest == 0xFFFFFFFF)) {
+        SkippedUnits++;
+        STATS_ADD(skipped, 4);
+        pDest++;
+        pSrc++;
+        continue;
       }
-      _FeedWDT();
-    } while(1);
-  } while(--NumWords);
+      *pDest++ = *pSrc++;
+      STATS_ADD(written, 4);
+      //
+      // Wait for operation to complete
+      //
+      Deadline += Step;
+      r = _WaitReady(Deadline, 0);
+    } while (--NumBlock && (r == 0));
+  }
   //
   // Bring back flash controller into read mode
   //
   FLASH_REG_CONFIG = FLASH_MODE_READ;
-  return (0);                                  // Finished without Errors
+  return (STATS_LEAVE(STATS_PROGRAMPAGE, r));
+}
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  const U32* pDest;
+  const U32* pSrc;
+  U32 NumWords;
+  U32 i;
+
+  STATS_ENTER(STATS_VERIFY);
+
+  pDest = (const U32*)adr;
+  pSrc = (const U32*)buf;
+  //
+  // Compare word by word if both sides are 32-bit aligned,
+  // the byte loop locates the failing byte and handles the tail
+  //
+  NumWords = ((adr | (U32)buf) & 3) ? 0 : (sz >> 2);
+  i = 0;
+  while ((i + 4) <= NumWords) {
+    if ((pDest[i]     != pSrc[i])     || (pDest[i + 1] != pSrc[i + 1]) ||
+        (pDest[i + 2] != pSrc[i + 2]) || (pDest[i + 3] != pSrc[i + 3])) {
+      break;
+    }
+    i += 4;
+  }
+  while (i < NumWords) {
+    if (pDest[i] != pSrc[i]) {
+      break;
+    }
+    i++;
+  }
+  for (i <<= 2; i < sz; i++) {
+    if (((const U8*)adr)[i] != buf[i]) {
+      break;
+    }
+  }
+  return (STATS_LEAVE(STATS_VERIFY, adr + i));
+}
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+  const U32* pDest;
+  U32 Pattern;
+
+  STATS_ENTER(STATS_BLANKCHECK);
+  //
+  // Replicate pattern byte into a word
+  //
+  Pattern = pat | ((U32)pat << 8);
+  Pattern |= Pattern << 16;
+  //
+  // Leading bytes up to word alignment
+  //
+  while (sz && (adr & 3)) {
+    if (*(const U8*)adr != pat) {
+      return (STATS_LEAVE(STATS_BLANKCHECK, 1));
+    }
+    adr++;
+    sz--;
+  }
+  //
+  // Aligned words, stop at the first non-blank word
+  //
+  pDest = (const U32*)adr;
+  while (sz >= 4) {
+    if (*pDest != Pattern) {
+      return (STATS_LEAVE(STATS_BLANKCHECK, 1));
+    }
+    pDest++;
+    sz -= 4;
+  }
+  //
+  // Trailing bytes
+  //
+  adr = (U32)pDest;
+  while (sz) {
+    if (*(const U8*)adr != pat) {
+      return (STATS_LEAVE(STATS_BLANKCHECK, 1));
+    }
+    adr++;
+    sz--;
+  }
+  return (STATS_LEAVE(STATS_BLANKCHECK, 0));     // Memory is blank
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long ComputeCRC (unsigned long adr, unsigned long sz) {
+  const U32* pSrc;
+  U32 NumWords;
+  U32 CRC;
+  U32 i;
+
+  STATS_ENTER(STATS_COMPUTECRC);
+
+  pSrc = (const U32*)adr;
+  NumWords = (adr & 3) ? 0 : (sz >> 2);
+  CRC = 0xFFFFFFFF;
+  //
+  // One word load, 4 table lookups
+  //
+  for (i = 0; i < NumWords; i++) {
+    CRC ^= pSrc[i];
+    CRC = (CRC >> 8) ^ _aCRCTable[CRC & 0xFF];
+    CRC = (CRC >> 8) ^ _aCRCTable[CRC & 0xFF];
+    CRC = (CRC >> 8) ^ _aCRCTable[CRC & 0xFF];
+    CRC = (CRC >> 8) ^ _aCRCTable[CRC & 0xFF];
+  }
+  //
+  // Remaining bytes
+  //
+  for (i <<= 2; i < sz; i++) {
+    CRC = (CRC >> 8) ^ _aCRCTable[(CRC ^ ((const U8*)adr)[i]) & 0xFF];
+  }
+  return (STATS_LEAVE(STATS_COMPUTECRC, ~CRC));
+}
+
+/*
+ *  State of the page started by ProgramPageStart, polled by the host
+ *  over the debug port while the core is running
+ */
+volatile struct PageStatus PageStatus = { PAGE_IDLE, 0, 0 };
+
+/*
+ *  Start programming a Page, pipelined mode
+ *   the host does not wait for the call to return, it loads the next page
+ *   into its second buffer while this one is written and polls PageStatus
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageStart (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  int r;
+
+  STATS_ENTER(STATS_PROGRAMSTART);
+
+  PageStatus.adr = adr;
+  PageStatus.buf = (U32)buf;
+  PageStatus.state = PAGE_BUSY;
+  r = ProgramPage(adr, sz, buf);
+  PageStatus.state = (r == 0) ? PAGE_DONE : PAGE_FAILED;
+  return (STATS_LEAVE(STATS_PROGRAMSTART, r));
+}
+
+/*
+ *  Start erasing a Sector, background mode
+ *   returns once the erase runs, the host polls EraseProgress. The
+ *   watchdog is only fed by EraseProgress while the erase runs
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - started
+ */
+int EraseSectorStart (unsigned long adr) {
+  STATS_ENTER(STATS_ERASESECTORSTART);
+  _EraseBegin(adr, FLASH_DEV_TO_ERASE);
+  if (adr >= 0x10001000) {
+    FLASH_REG_ERASEUICR = 1;
+  } else {
+    FLASH_REG_ERASEPAGE = adr;
+  }
+  return (STATS_LEAVE(STATS_ERASESECTORSTART, 0));
+}
+
+/*
+ *  Start erasing the complete Flash Memory, background mode
+ *    Return Value:   0 - started
+ */
+int EraseChipStart (void) {
+  STATS_ENTER(STATS_ERASECHIPSTART);
+  _EraseBegin(FLASH_DEV_ADDR, FLASH_DEV_TO_ERASE * 2);
+  FLASH_REG_ERASEALL = 1;             // CODE and UICR
+  return (STATS_LEAVE(STATS_ERASECHIPSTART, 0));
+}
+
+/*
+ *  State of the erase started last, ends it once the NVMC is ready
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+int EraseProgress (void) {
+  if (EraseStatus.state == ERASE_BUSY) {
+    _FeedWDT();
+  }
+  _EraseCheck(0);
+  return (EraseStatus.state);
+}
+
+/*
+ *  Erase all Sectors overlapping a Range of Flash Memory
+ *   walks the sector table (FlashDev.h) on the target, so the host
+ *   needs a single call instead of one EraseSector call per sector
+ *    Parameter:      start:  Start Address
+ *                    size:   Size (in bytes)
+ *    Return Value:   0 - OK,  error code
+ */
+int EraseRange (unsigned long start, unsigned long size) {
+  const struct FlashSectors* pSector;
+  U32 Limit = FLASH_DEV_ADDR + FLASH_DEV_SIZE;
+  U32 Last = 0;
+  U32 Addr;
+  U32 End;
+
+  STATS_ENTER(STATS_ERASERANGE);
+
+  //
+  // End of the range, at most the end of the device, start + size may wrap
+  //
+  if (start < Limit) {
+    Last = (size > Limit - start) ? Limit : start + size;
+  }
+  for (pSector = _aSectors; pSector->szSector != 0xFFFFFFFF; pSector++) {
+    Addr = FLASH_DEV_ADDR + pSector->AddrSector;
+    //
+    // Each entry covers the flash up to the next entry
+    //
+    End = (pSector[1].szSector != 0xFFFFFFFF) ? (FLASH_DEV_ADDR + pSector[1].AddrSector) : (FLASH_DEV_ADDR + FLASH_DEV_SIZE);
+    for (; (Addr < End) && (Addr < Last); Addr += pSector->szSector) {
+      if ((Addr + pSector->szSector > start) && _EraseSector(Addr)) {
+        return (STATS_LEAVE(STATS_ERASERANGE, FLASH_ERR_TIMEOUT));
+      }
+    }
+  }
+  return (STATS_LEAVE(STATS_ERASERANGE, 0));
+}
+
+/*
+ *  LZ4 decompression buffer, programmed with ProgramPage when full
+ */
+#define LZ4_CHUNK   256               // Decompressed bytes per ProgramPage
+#define LZ4_PAD     4                 // Last chunk is padded to whole words
+
+static U32 _aLZ4Words[LZ4_CHUNK / 4];  // Word aligned for ProgramPage
+#define _aLZ4Buf ((U8*)_aLZ4Words)
+static U32 _LZ4Addr;                  // Flash address of _aLZ4Buf[0]
+static U32 _LZ4Fill;                  // Bytes in _aLZ4Buf
+
+const U32 LZ4ChunkSize = LZ4_CHUNK;   // Read by flash_algo_gen.py
+
+static int _LZ4Out(U8 Data) {
+  _aLZ4Buf[_LZ4Fill++] = Data;
+  if (_LZ4Fill < LZ4_CHUNK) {
+    return 0;
+  }
+  _LZ4Fill = 0;
+  _LZ4Addr += LZ4_CHUNK;
+  return ProgramPage(_LZ4Addr - LZ4_CHUNK, LZ4_CHUNK, _aLZ4Buf);
+}
+
+/*
+ *  Program LZ4 compressed data
+ *   buf holds LZ4 block sequences, a sequence with offset 0 has no match
+ *   so the host can cut a stream after any sequence. Matches may reach
+ *   back into flash programmed before, by this or an earlier call. The
+ *   last chunk is padded with erased bytes to whole words.
+ *    Parameter:      adr:  Start Address of the decompressed data
+ *                    sz:   Size of the compressed data
+ *                    buf:  Compressed data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageLZ4 (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  const U8* pIn;
+  const U8* pEnd;
+  U32 Len;
+  U32 Off;
+  U8 Token;
+  U8 Data;
+
+  STATS_ENTER(STATS_PROGRAMLZ4);
+
+  pIn = buf;
+  pEnd = buf + sz;
+  _LZ4Addr = adr;
+  _LZ4Fill = 0;
+  while (pIn < pEnd) {
+    //
+    // Literals
+    //
+    Token = *pIn++;
+    Len = Token >> 4;
+    if (Len == 15) {
+      do {
+        if (pIn == pEnd) {
+          return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated stream
+        }
+        Data = *pIn++;
+        Len += Data;
+      } while (Data == 255);
+    }
+    if (Len > (U32)(pEnd - pIn)) {
+      return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated stream
+    }
+    for (; Len; Len--) {
+      if (_LZ4Out(*pIn++)) {
+        return (STATS_LEAVE(STATS_PROGRAMLZ4, 1));
+      }
+    }
+    if (pIn == pEnd) {
+      break;                          // Last sequence, no match
+    }
+    //
+    // Match, copied from the buffer or from flash
+    //
+    if ((pEnd - pIn) < 2) {
+      return (STATS_LEAVE(STATS_PROGRAMLZ4, 1));
+    }
+    Off = pIn[0] | (pIn[1] << 8);
+    pIn += 2;
+    Len = Token & 15;
+    if (Len == 15) {
+      do {
+        if (pIn == pEnd) {
+          return (STATS_LEAVE(STATS_PROGRAMLZ4, 1)); // Truncated stream
+        }
+        Data = *pIn++;
+        Len += Data;
+      } while (Data == 255);
+    }
+    if (Off == 0) {
+      continue;
+    }
+    for (Len += 4; Len; Len--) {
+      Data = (Off <= _LZ4Fill) ? _aLZ4Buf[_LZ4Fill - Off] : *(const U8*)(_LZ4Addr - (Off - _LZ4Fill));
+      if (_LZ4Out(Data)) {
+        return (STATS_LEAVE(STATS_PROGRAMLZ4, 1));
+      }
+    }
+  }
+  if (_LZ4Fill == 0) {
+    return (STATS_LEAVE(STATS_PROGRAMLZ4, 0));
+  }
+  while (_LZ4Fill % LZ4_PAD) {
+    _aLZ4Buf[_LZ4Fill++] = FLASH_DEV_EMPTY;
+  }
+  return STATS_LEAVE(STATS_PROGRAMLZ4, ProgramPage(_LZ4Addr, _LZ4Fill, _aLZ4Buf));
+}
+
+/*
+ *  Delta programming: the host sends ops that rebuild flash from what it
+ *  holds now, page by page in _aDeltaBuf. Each op is a varint holding
+ *  (length << 1 | type), DELTA_COPY is followed by a varint source offset
+ *  from the device start, DELTA_DATA by length literal bytes. Past the end
+ *  of the ops a page keeps its current contents.
+ */
+#define DELTA_COPY  0
+#define DELTA_DATA  1
+#define DELTA_BUF   1024              // One code page
+
+static U32 _aDeltaWords[DELTA_BUF / 4];  // Word aligned for ProgramPage
+#define _aDeltaBuf ((U8*)_aDeltaWords)
+
+const U32 DeltaBufSize = DELTA_BUF;   // Read by flash_algo_gen.py
+
+typedef struct {
+  const U8* pIn;                      // Next op
+  const U8* pEnd;
+  U32 Type;                           // Current op
+  U32 Left;                           // Bytes left in the current op
+  U32 Src;                            // DELTA_COPY source address
+} DELTA_STATE;
+
+static int _DeltaVarint(DELTA_STATE* pState, U32* pValue) {
+  U32 Shift;
+  U8 Data;
+
+  *pValue = 0;
+  Shift = 0;
+  do {
+    if ((pState->pIn == pState->pEnd) || (Shift > 28)) {
+      return 1;
+    }
+    Data = *pState->pIn++;
+    *pValue |= (U32)(Data & 0x7F) << Shift;
+    Shift += 7;
+  } while (Data & 0x80);
+  return 0;
+}
+
+/*
+ *  Rebuild NumBytes of flash at Addr into pBuf. Sectors bigger than the
+ *  buffer are not possible on nRF51, so reading the page itself is fine.
+ */
+static int _DeltaRead(DELTA_STATE* pState, U32 Addr, U32 NumBytes, U8* pBuf) {
+  const U8* pSrc;
+  U32 Value;
+  U32 n;
+
+  while (NumBytes) {
+    if ((pState->Left == 0) && (pState->pIn != pState->pEnd)) {
+      //
+      // Next op
+      //
+      if (_DeltaVarint(pState, &Value)) {
+        return 1;
+      }
+      pState->Type = Value & 1;
+      pState->Left = Value >> 1;
+      if (pState->Type == DELTA_COPY) {
+        if (_DeltaVarint(pState, &pState->Src)) {
+          return 1;
+        }
+        pState->Src += FLASH_DEV_ADDR;
+      } else if (pState->Left > (U32)(pState->pEnd - pState->pIn)) {
+        return 1;                     // Truncated stream
+      }
+      continue;
+    }
+    if (pState->Left == 0) {
+      n = NumBytes;                   // Past the end, keep
+      pSrc = (const U8*)Addr;
+    } else {
+      n = (pState->Left < NumBytes) ? pState->Left : NumBytes;
+      pState->Left -= n;
+      if (pState->Type == DELTA_DATA) {
+        pSrc = pState->pIn;
+        pState->pIn += n;
+      } else {
+        pSrc = (const U8*)pState->Src;
+        pState->Src += n;
+      }
+    }
+    Addr += n;
+    NumBytes -= n;
+    do {
+      *pBuf++ = *pSrc++;
+    } while (--n);
+  }
+  return 0;
+}
+
+/*
+ *  Program a Delta against the current Flash Contents
+ *   each page from adr on is rebuilt from the ops in buf and only
+ *   erased and programmed when it changes
+ *    Parameter:      adr:  Start Address, on a page boundary
+ *                    sz:   Size of the ops
+ *                    buf:  Ops
+ *    Return Value:   0 - OK,  error code
+ */
+int ProgramDelta (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  DELTA_STATE State;
+  U32 PageSize;
+  U32 i;
+
+  STATS_ENTER(STATS_PROGRAMDELTA);
+
+  PageSize = INFO_REG_CODEPAGESIZE;
+  if ((PageSize > DELTA_BUF) || (adr & (PageSize - 1))) {
+    return (STATS_LEAVE(STATS_PROGRAMDELTA, 1));
+  }
+  State.pIn = buf;
+  State.pEnd = buf + sz;
+  State.Type = DELTA_DATA;
+  State.Left = 0;
+  State.Src = 0;
+  while ((State.pIn != State.pEnd) || State.Left) {
+    if (adr >= FLASH_DEV_ADDR + FLASH_DEV_SIZE) {
+      return (STATS_LEAVE(STATS_PROGRAMDELTA, 1));
+    }
+    if (_DeltaRead(&State, adr, PageSize, _aDeltaBuf)) {
+      return (STATS_LEAVE(STATS_PROGRAMDELTA, 1));
+    }
+    for (i = 0; i < PageSize; i++) {
+      if (_aDeltaBuf[i] != *(const U8*)(adr + i)) {
+        if (_EraseSector(adr) || ProgramPage(adr, PageSize, _aDeltaBuf)) {
+          return (STATS_LEAVE(STATS_PROGRAMDELTA, FLASH_ERR_TIMEOUT));
+        }
+        break;
+      }
+    }
+    adr += PageSize;
+  }
+  return (STATS_LEAVE(STATS_PROGRAMDELTA, 0));
+}
+
+/*
+ *  Update programming: a page is only erased when the new data cannot be
+ *  written over what the flash holds now. The NVMC allows a word to be
+ *  written again as long as bits only go from 1 to 0, up to n_WRITE
+ *  times between erases, so the host should use this for data that
+ *  changes rarely, like calibration and config blocks.
+ */
+#define UPDATE_SAME     0             // Word unchanged
+#define UPDATE_PROGRAM  1             // Word can be written in place
+#define UPDATE_ERASE    2             // Word needs an erase
+
+static int _UpdateWord(U32 Old, U32 New) {
+  if (Old == New) {
+    return UPDATE_SAME;
+  }
+  return ((Old & New) == New) ? UPDATE_PROGRAM : UPDATE_ERASE;
 }
+
+/*
+ *  Program Page in update mode
+ *   the range is compared with the flash page by page. Changed words
+ *   that only clear bits are written in place, otherwise the page is
+ *   merged with its current contents in _aDeltaBuf, erased and written.
+ *    Parameter:      adr:  Start Address, word aligned
+ *                    sz:   Size, a multiple of 4
+ *                    buf:  Data
+ *    Return Value:   0 - OK,  error code
+ */
+int ProgramPageUpdate (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  const U32* pOld;
+  const U32* pNew;
+  U32 PageSize;
+  U32 Start;
+  U32 NumWords;
+  U32 Run;
+  U32 Erase;
+  U32 i;
+
+  STATS_ENTER(STATS_PROGRAMUPDATE);
+
+  PageSize = INFO_REG_CODEPAGESIZE;
+  if ((PageSize > DELTA_BUF) || (adr & 3) || (sz & 3)) {
+    return (STATS_LEAVE(STATS_PROGRAMUPDATE, 1));
+  }
+  while (sz) {
+    Start = adr & ~(PageSize - 1);
+    NumWords = (((Start + PageSize - adr) < sz) ? (Start + PageSize - adr) : sz) >> 2;
+    pOld = (const U32*)adr;
+    pNew = (const U32*)buf;
+    //
+    // Check whether all changed words only clear bits
+    //
+    Erase = 0;
+    for (i = 0; (i < NumWords) && (Erase == 0); i++) {
+      Erase = (_UpdateWord(pOld[i], pNew[i]) == UPDATE_ERASE);
+    }
+    if (Erase == 0) {
+      //
+      // Write the runs of changed words
+      //
+      for (i = 0; i < NumWords; i += Run + 1) {
+        for (Run = 0; (i + Run < NumWords) && (_UpdateWord(pOld[i + Run], pNew[i + Run]) == UPDATE_PROGRAM); Run++);
+        if (Run && ProgramPage(adr + (i << 2), Run << 2, buf + (i << 2))) {
+          return (STATS_LEAVE(STATS_PROGRAMUPDATE, FLASH_ERR_TIMEOUT));
+        }
+      }
+    } else {
+      //
+      // Keep the rest of the page
+      //
+      for (i = 0; i < PageSize; i++) {
+        _aDeltaBuf[i] = ((Start + i >= adr) && (Start + i < adr + (NumWords << 2))) ? buf[Start + i - adr] : *(const U8*)(Start + i);
+      }
+      if (_EraseSector(Start) || ProgramPage(Start, PageSize, _aDeltaBuf)) {
+        return (STATS_LEAVE(STATS_PROGRAMUPDATE, FLASH_ERR_TIMEOUT));
+      }
+    }
+    adr += NumWords << 2;
+    buf += NumWords << 2;
+    sz -= NumWords << 2;
+  }
+  return (STATS_LEAVE(STATS_PROGRAMUPDATE, 0));
+}
+
+#ifdef FLASH_AGENT
+#define AGENT_WAIT()  _FeedWDT()      // Keep a running watchdog fed while idle
+#include "../FlashAgent.h"            // Resident agent, after the entry points
+#endif
@@ -0,0 +1,1361 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  STM32 flash driver core, shared by the F0/F1/F3 (common), F4 and L4
+ *  algorithms. Each FlashPrg.c includes it after its register definitions,
+ *  the flashSectors table and SkippedUnits, and describes its controller
+ *  with these macros:
+ *
+ *   FLASH_KEYR_REG, FLASH_SR_REG, FLASH_CR_REG, FLASH_UNLOCK_KEY1/2,
+ *   FLASH_SR_BSY, FLASH_CR_LOCK, FLASH_CR_STRT, FLASH_CR_PG
+ *                          registers and bits, same names in every family
+ *   CORE_SR_ERRORS         SR error flags, sticky until cleared
+ *   CORE_SR_PROTECTED      SR flag of a write or erase protection error
+ *   CORE_SR_CLEAR          SR flags cleared before an operation
+ *   CORE_CR_MASS           CR bits of a mass erase
+ *   CORE_CR_ERASE          CR bits of a sector erase
+ *   CORE_CR_SECTOR(n)      CR bits selecting sector n, undefined when the
+ *                          sector is selected by address in FLASH_AR_REG
+ *   CORE_CR_MASK           CR fields replaced by the bits above
+ *   CORE_READBACK          1 to compare each unit after programming, when
+ *                          SR does not flag a unit that was not erased
+ *   CORE_CLK_MAX           highest core clock of the family in Hz
+ *   CORE_LZ4_PAD           ProgramPageLZ4 pads its last chunk to this size
+ *                          with FLASH_DEV_EMPTY, the largest write unit
+ *   CORE_DELTA_BUF         bytes of the sector rebuild buffer of ProgramDelta
+ *                          and ProgramPageUpdate, a multiple of 16
+ *   CORE_UPDATE_UNIT       bytes per write of ProgramPageUpdate, the algorithm
+ *                          defines updateUnit() with the rule of its flash
+ *                          for programming a unit in place
+ *   CORE_UPDATE_PROGRAM    optional, writes the units ProgramPageUpdate
+ *                          programs in place, ProgramPage by default
+ *   CORE_MASS_ERASED(m)    optional, called with 0 when an erase starts and
+ *                          with 1 when a mass erase ended without error
+ *
+ *  Every wait for BSY is bounded. SysTick counts core cycles at the clock
+ *  passed to Init, or at CORE_CLK_MAX when that is 0 so that a faster
+ *  clock never shortens a time out. An erase may take FLASH_DEV_TO_ERASE,
+ *  a mass erase four times that, and each programmed unit its share of
+ *  FLASH_DEV_TO_PROG for a page. Functions return 0, FLASH_ERR_TIMEOUT,
+ *  FLASH_ERR_PROTECTED or FLASH_ERR_FAILED, a programming loop stops at
+ *  the first unit that sets an error flag.
+ *
+ *  coreEraseSectorStart and coreEraseChipStart only start the erase and
+ *  return, EraseStatus keeps its state and coreEraseCheck ends it once BSY
+ *  is clear, from EraseProgress or from the next coreBegin. The host checks
+ *  the time out, the core is halted in between.
+ *
+ *  Built with FLASH_STATS defined, the entry points count calls and cycles
+ *  and the waits and programming loops busy polls and bytes in FlashStats
+ *  (FlashOS.h), through the STATS_ macros below. Otherwise these expand
+ *  to nothing.
+ *
+ *  The programming loop is generated per write width with
+ *  CORE_PROGRAM_LOOP, so each algorithm only holds the loops it uses and
+ *  none of them branches on the width.
+ *
+ *  The entry points at the end only build on ProgramPage and EraseSector
+ *  of the algorithm and are the same in every family, so an algorithm
+ *  itself holds Init, UnInit, EraseChip, EraseSector, ProgramPage,
+ *  ComputeCRC and updateUnit.
+ */
+
+#ifndef CORE_MASS_ERASED
+#define CORE_MASS_ERASED(m)
+#endif
+
+/*********************************************************************
+*
+*      Instruction barrier, x64 units are written as two words
+*/
+#if defined (__CC_ARM)
+#define ISB()                  __isb(0xF)
+#elif defined (__GNUC__) && defined (__arm__)
+#define ISB()                  __asm volatile ("isb")
+#else
+#define ISB()
+#endif
+
+/*
+ *  64-bit write unit, host builds (tools/flashsim) define "long" as int
+ */
+#if defined (__GNUC__) && !defined (__arm__)
+typedef unsigned int CORE_U64 __attribute__((mode(DI)));
+#else
+typedef U64 CORE_U64;
+#endif
+
+
+/*
+ *  Unlock the flash
+ *    Parameter:      None
+ *    Return Value:   0 - OK,
+ */
+ int UnlockFlash(void) {
+    FLASH_KEYR_REG = FLASH_UNLOCK_KEY1;
+    FLASH_KEYR_REG = FLASH_UNLOCK_KEY2;
+    return 0;
+ }
+
+/*********************************************************************
+*
+*      SysTick, counts core cycles for the time outs
+*/
+#define SYST_CSR_REG         (*(volatile unsigned long *)0xE000E010)
+#define SYST_RVR_REG         (*(volatile unsigned long *)0xE000E014)
+#define SYST_CVR_REG         (*(volatile unsigned long *)0xE000E018)
+
+#define SYST_CSR_ENABLE      0x00000001
+#define SYST_CSR_CLKSOURCE   0x00000004     // core clock
+#define SYST_MAX             0x00FFFFFF
+
+#define CORE_POLLS           16             // BSY polls per SysTick sample
+#define CORE_MASS_ERASE      4              // mass erase time out, in toErase
+
+static U32 coreKHz = CORE_CLK_MAX / 1000;   // core cycles per ms
+static U32 coreLast = 0;                    // SysTick at the last sample
+static U32 coreTotal = 0;                   // cycles since Init, wraps
+static U32 coreMark = 0;                    // coreTotal at coreTimerStart
+static U32 coreSaved = 0;                   // 1 - SysTick of the application saved
+static U32 coreCSR = 0;                     // its SYST_CSR, restored by UnInit
+static U32 coreRVR = 0;                     // its SYST_RVR
+
+/*
+ *  start SysTick as a free running counter, called by Init
+ *   the setup of the application is saved first, a second Init without
+ *   UnInit keeps the saved one
+ *    Parameter:      clk:  core clock in Hz, 0 - not known
+ */
+static void coreTimerInit (U32 clk) {
+	coreKHz = ((clk != 0) ? clk : CORE_CLK_MAX) / 1000;
+	if(coreSaved == 0)
+	{
+		coreCSR = SYST_CSR_REG;
+		coreRVR = SYST_RVR_REG;
+		coreSaved = 1;
+	}
+	SYST_CSR_REG = 0;
+	SYST_RVR_REG = SYST_MAX;
+	SYST_CVR_REG = 0;
+	SYST_CSR_REG = SYST_CSR_CLKSOURCE | SYST_CSR_ENABLE;
+	coreLast = SYST_CVR_REG;
+}
+
+/*
+ *  give SysTick back to the application, called by UnInit
+ *   the counter restarts from the saved reload value
+ */
+static void coreTimerStop (void) {
+	if(coreSaved == 0)
+	{
+		return;
+	}
+	SYST_CSR_REG = 0;
+	SYST_RVR_REG = coreRVR;
+	SYST_CVR_REG = 0;
+	SYST_CSR_REG = coreCSR;
+	coreSaved = 0;
+}
+
+/*
+ *  core cycles of a time out
+ *    Parameter:      ms:  time out in ms
+ *    Return Value:   cycles, saturated at half the counter range so that
+ *                    an elapsed count cannot wrap past it unnoticed
+ */
+static U32 coreCycles (U32 ms) {
+	return (ms < (0x7FFFFFFF / coreKHz)) ? ms * coreKHz : 0x7FFFFFFF;
+}
+
+/*
+ *  cycles since Init, SysTick must not wrap between two samples
+ */
+static U32 coreClock (void) {
+	U32 now = SYST_CVR_REG;
+
+	coreTotal += (coreLast - now) & SYST_MAX;
+	coreLast = now;
+	return coreTotal;
+}
+
+static void coreTimerStart (void) {
+	coreMark = coreClock();
+}
+
+/*
+ *  cycles since coreTimerStart
+ */
+static U32 coreTimer (void) {
+	return coreClock() - coreMark;
+}
+
+
+/*********************************************************************
+*
+*      Statistics, FlashStats in FlashOS.h
+*/
+#ifdef FLASH_STATS
+volatile struct FlashStats FlashStats;
+static U32 statsStart[STATS_ENTRIES];        // coreClock at entry
+
+/*
+ *  clear the counters, called by Init after coreTimerInit
+ */
+static void statsClear (void) {
+	U32 i = 0;
+
+	FlashStats.busyPolls = FlashStats.busyCycles = 0;
+	FlashStats.written = FlashStats.skipped = 0;
+	for(i = 0; i < STATS_ENTRIES; i++)
+	{
+		FlashStats.entry[i].calls = FlashStats.entry[i].cycles = 0;
+	}
+	FlashStats.version = STATS_VERSION;
+}
+
+static void statsEnter (U32 entry) {
+	FlashStats.entry[entry].calls++;
+	statsStart[entry] = coreClock();
+}
+
+/*
+ *  account the cycles of an entry point
+ *    Return Value:   result, passed through
+ */
+static U32 statsLeave (U32 entry, U32 result) {
+	FlashStats.entry[entry].cycles += coreClock() - statsStart[entry];
+	return result;
+}
+
+#define STATS_CLEAR()          statsClear()
+#define STATS_ENTER(entry)     statsEnter(entry)
+#define STATS_LEAVE(entry, r)  statsLeave(entry, r)
+#define STATS_ADD(field, n)    (FlashStats.field += (n))
+#else
+#define STATS_CLEAR()
+#define STATS_ENTER(entry)
+#define STATS_LEAVE(entry, r)  (r)
+#define STATS_ADD(field, n)
+#endif
+
+/*
+ *  wait for the end of an operation
+ *    Parameter:      deadline:  cycles since coreTimerStart
+ *                    sr:        set to the last SR read
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int coreWait (U32 deadline, U32* sr) {
+	U32 polls = 0;
+	int result = 0;
+#ifdef FLASH_STATS
+	U32 start = coreClock();
+#endif
+
+	while(((*sr = FLASH_SR_REG) & FLASH_SR_BSY) == FLASH_SR_BSY)
+	{
+		if(((++polls % CORE_POLLS) == 0) && (coreTimer() >= deadline))
+		{
+			result = FLASH_ERR_TIMEOUT;
+			break;
+		}
+	}
+#ifdef FLASH_STATS
+	FlashStats.busyPolls += polls;
+	FlashStats.busyCycles += coreClock() - start;
+#endif
+	return result;
+}
+
+/*
+ *  error code of the SR flags of a finished operation
+ */
+static int coreResult (U32 sr) {
+	if((sr & CORE_SR_PROTECTED) != 0)
+	{
+		return FLASH_ERR_PROTECTED;
+	}
+	return ((sr & CORE_SR_ERRORS) != 0) ? FLASH_ERR_FAILED : 0;
+}
+
+/*
+ *  State of the erase started by EraseSectorStart or EraseChipStart,
+ *  updated by EraseProgress
+ */
+volatile struct EraseStatus EraseStatus = { ERASE_IDLE, 0, 0, 0, 0, 1 };
+static U32 eraseBits = 0;                   // CR bits of the started erase
+
+/*
+ *  end the started erase once BSY is clear, clears its CR bits and flags
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+static int coreEraseCheck (void) {
+	U32 sr = 0;
+
+	if(EraseStatus.state != ERASE_BUSY)
+	{
+		return EraseStatus.state;
+	}
+	sr = FLASH_SR_REG;
+	if((sr & FLASH_SR_BSY) == FLASH_SR_BSY)
+	{
+		return ERASE_BUSY;
+	}
+	FLASH_CR_REG &= ~eraseBits;
+	FLASH_SR_REG = sr & CORE_SR_CLEAR;
+	EraseStatus.result = coreResult(sr);
+	EraseStatus.done = 1;
+	EraseStatus.state = (EraseStatus.result == 0) ? ERASE_DONE : ERASE_FAILED;
+	if((EraseStatus.result == 0) && (eraseBits == CORE_CR_MASS))
+	{
+		CORE_MASS_ERASED(1);
+	}
+	return EraseStatus.state;
+}
+
+/*
+ *  unlock if locked, wait for BSY and clear the flags of earlier operations,
+ *  an erase started before is ended first
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int coreBegin (void) {
+	U32 sr = 0;
+
+	if((FLASH_CR_REG & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+	{
+		UnlockFlash();
+	}
+	coreTimerStart();
+	if(coreWait(coreCycles(FLASH_DEV_TO_ERASE), &sr) != 0)
+	{
+		return FLASH_ERR_TIMEOUT;
+	}
+	coreEraseCheck();
+	FLASH_SR_REG = CORE_SR_CLEAR;
+	return 0;
+}
+
+/*
+ *  start the erase selected in CR, wait for it and clear the bits again
+ *    Parameter:      bits:  CR bits set for the operation
+ *                    ms:    time out
+ *    Return Value:   0 - OK,  error code
+ */
+static int coreStart (U32 bits, U32 ms) {
+	U32 sr = 0;
+	int result = 0;
+
+	CORE_MASS_ERASED(0);
+	FLASH_CR_REG |= FLASH_CR_STRT;
+	coreTimerStart();
+	result = coreWait(coreCycles(ms), &sr);
+	FLASH_CR_REG &= ~bits;
+	FLASH_SR_REG = sr & CORE_SR_CLEAR;
+	if(result == 0)
+	{
+		result = coreResult(sr);
+	}
+	if((result == 0) && (bits == CORE_CR_MASS))
+	{
+		CORE_MASS_ERASED(1);
+	}
+	return result;
+}
+
+/*********************************************************************
+*
+*      16-byte block loops for compare, blank scan and copy. Built with
+*      FLASH_BLOCK_ASM defined, the Thumb-2 parts (F1, F3, F4, L4) load a
+*      block with one LDM and test it in an IT block; tools/gcc blocktest
+*      runs them against the C loops, which every other build uses.
+*      r7 (Thumb frame pointer) and r9 (static base) are left alone.
+*/
+#if defined (FLASH_BLOCK_ASM) && defined (__GNUC__) && defined (__ARM_ARCH_ISA_THUMB) && (__ARM_ARCH_ISA_THUMB == 2)
+#define BLOCK_THUMB2         1
+#else
+#define BLOCK_THUMB2         0
+#endif
+
+/*
+ *  Leading blocks of a and b that are equal, n at most
+ */
+static U32 blockCompare (const U32* a, const U32* b, U32 n) {
+#if BLOCK_THUMB2
+	U32 left = n;
+
+	__asm volatile (
+		"	cmp	%[left], #0\n"
+		"	beq	2f\n"
+		"1:	ldmia	%[a]!, {r4, r5, r6, r8}\n"
+		"	ldmia	%[b]!, {r10, r11, r12, lr}\n"
+		"	cmp	r4, r10\n"
+		"	ittt	eq\n"
+		"	cmpeq	r5, r11\n"
+		"	cmpeq	r6, r12\n"
+		"	cmpeq	r8, lr\n"
+		"	bne	2f\n"
+		"	subs	%[left], %[left], #1\n"
+		"	bne	1b\n"
+		"2:\n"
+		: [a] "+r" (a), [b] "+r" (b), [left] "+r" (left)
+		:
+		: "r4", "r5", "r6", "r8", "r10", "r11", "r12", "lr", "cc", "memory");
+	return n - left;
+#else
+	U32 i = 0;
+
+	for(i = 0; i < n; i++, a += 4, b += 4)
+	{
+		if((a[0] != b[0]) || (a[1] != b[1]) || (a[2] != b[2]) || (a[3] != b[3]))
+		{
+			break;
+		}
+	}
+	return i;
+#endif
+}
+
+/*
+ *  Leading blocks at p that hold pattern in every word, n at most
+ */
+static U32 blockBlank (const U32* p, U32 n, U32 pattern) {
+#if BLOCK_THUMB2
+	U32 left = n;
+
+	__asm volatile (
+		"	cmp	%[left], #0\n"
+		"	beq	2f\n"
+		"1:	ldmia	%[p]!, {r4, r5, r6, r8}\n"
+		"	cmp	r4, %[pat]\n"
+		"	ittt	eq\n"
+		"	cmpeq	r5, %[pat]\n"
+		"	cmpeq	r6, %[pat]\n"
+		"	cmpeq	r8, %[pat]\n"
+		"	bne	2f\n"
+		"	subs	%[left], %[left], #1\n"
+		"	bne	1b\n"
+		"2:\n"
+		: [p] "+r" (p), [left] "+r" (left)
+		: [pat] "r" (pattern)
+		: "r4", "r5", "r6", "r8", "cc", "memory");
+	return n - left;
+#else
+	U32 i = 0;
+
+	for(i = 0; i < n; i++, p += 4)
+	{
+		if((p[0] != pattern) || (p[1] != pattern) || (p[2] != pattern) || (p[3] != pattern))
+		{
+			break;
+		}
+	}
+	return i;
+#endif
+}
+
+/*
+ *  Copy n bytes, by blocks when both sides are word aligned
+ */
+static void copyBytes (U8* dst, const U8* src, U32 n) {
+	U32* d = (U32*)dst;
+	const U32* s = (const U32*)src;
+	U32 left = n >> 4;
+	U32 i = 0;
+
+	if((((U32)dst | (U32)src) & 3) == 0)
+	{
+#if BLOCK_THUMB2
+		__asm volatile (
+			"	cmp	%[left], #0\n"
+			"	beq	2f\n"
+			"1:	ldmia	%[s]!, {r4, r5, r6, r8}\n"
+			"	stmia	%[d]!, {r4, r5, r6, r8}\n"
+			"	subs	%[left], %[left], #1\n"
+			"	bne	1b\n"
+			"2:\n"
+			: [d] "+r" (d), [s] "+r" (s), [left] "+r" (left)
+			:
+			: "r4", "r5", "r6", "r8", "cc", "memory");
+#else
+		for(; left != 0; left--, d += 4, s += 4)
+		{
+			d[0] = s[0];
+			d[1] = s[1];
+			d[2] = s[2];
+			d[3] = s[3];
+		}
+#endif
+		i = n & ~15UL;
+	}
+	for(; i < n; i++)
+	{
+		dst[i] = src[i];
+	}
+}
+
+/*
+ *  start address of a sector table entry, the end of the device for
+ *  SECTOR_END. FlashDev.h gives them absolute or as device offsets
+ */
+static U32 coreSectorStart (const struct FlashSectors* pSector) {
+	U32 start = pSector->AddrSector;
+
+	if(pSector->szSector == 0xFFFFFFFF)
+	{
+		return FLASH_DEV_ADDR + FLASH_DEV_SIZE;
+	}
+	if(start < FLASH_DEV_ADDR)
+	{
+		start += FLASH_DEV_ADDR;
+	}
+	return start;
+}
+
+/*
+ *  Sector containing an address, from the sector table
+ *    Parameter:      adr:    flash address
+ *                    first:  set to the start of the sector
+ *    Return Value:   sector size, 0 outside the flash
+ */
+static U32 findSector (U32 adr, U32* first) {
+	const struct FlashSectors* pSector = flashSectors;
+	U32 start = 0;
+
+	for(; pSector->szSector != 0xFFFFFFFF; pSector++)
+	{
+		start = coreSectorStart(pSector);
+		if((adr >= start) && (adr < coreSectorStart(pSector + 1)))
+		{
+			*first = adr - (adr - start) % pSector->szSector;
+			return pSector->szSector;
+		}
+	}
+	return 0;
+}
+
+/*
+ *  Delta programming: the host sends ops that rebuild flash from what it
+ *  holds now, sector by sector in deltaBuf. Each op is a varint holding
+ *  (length << 1 | type), DELTA_COPY is followed by a varint source offset
+ *  from the device start, DELTA_DATA by length literal bytes. Past the end
+ *  of the ops a sector keeps its current contents.
+ */
+#define DELTA_COPY           0
+#define DELTA_DATA           1
+
+static U32 deltaWords[CORE_DELTA_BUF / 4]; // word aligned for ProgramPage
+#define deltaBuf ((U8*)deltaWords)
+
+const U32 DeltaBufSize = CORE_DELTA_BUF;    // read by flash_algo_gen.py
+
+struct DeltaState {
+	const U8* in;                             // next op
+	const U8* end;
+	U32 type;                                 // current op
+	U32 left;                                 // bytes left in the current op
+	U32 src;                                  // DELTA_COPY source address
+};
+
+static int deltaVarint (struct DeltaState* d, U32* v) {
+	U32 shift = 0;
+	U8 b = 0;
+
+	*v = 0;
+	do {
+		if((d->in == d->end) || (shift > 28))
+		{
+			return 1;
+		}
+		b = *d->in++;
+		*v |= (U32)(b & 0x7F) << shift;
+		shift += 7;
+	} while((b & 0x80) != 0);
+	return 0;
+}
+
+/*
+ *  Rebuild sz bytes of flash at adr into buf, *self is set when flash
+ *  between lo and hi is read
+ */
+static int deltaRead (struct DeltaState* d, U32 adr, U32 sz, U8* buf, U32 lo, U32 hi, U32* self) {
+	const U8* src = 0;
+	U32 n = 0;
+	U32 v = 0;
+
+	while(sz != 0)
+	{
+		if((d->left == 0) && (d->in != d->end))
+		{
+			/*next op*/
+			if(deltaVarint(d, &v) != 0)
+			{
+				return 1;
+			}
+			d->type = v & 1;
+			d->left = v >> 1;
+			if(d->type == DELTA_COPY)
+			{
+				if(deltaVarint(d, &d->src) != 0)
+				{
+					return 1;
+				}
+				d->src += FLASH_DEV_ADDR;
+			}
+			else if(d->left > (U32)(d->end - d->in))
+			{
+				return 1;                           // truncated stream
+			}
+			continue;
+		}
+		if(d->left == 0)
+		{
+			n = sz;                               // past the end, keep
+			src = (const U8*)adr;
+		}
+		else if(d->type == DELTA_DATA)
+		{
+			n = (d->left < sz) ? d->left : sz;
+			d->left -= n;
+			copyBytes(buf, d->in, n);
+			d->in += n;
+			src = 0;
+		}
+		else
+		{
+			n = (d->left < sz) ? d->left : sz;
+			d->left -= n;
+			src = (const U8*)d->src;
+			d->src += n;
+		}
+		if(src != 0)
+		{
+			if(((U32)src < hi) && ((U32)src + n > lo))
+			{
+				*self = 1;
+			}
+			copyBytes(buf, src, n);
+		}
+		buf += n;
+		adr += n;
+		sz -= n;
+	}
+	return 0;
+}
+
+/*
+ *  Program a Delta against the current Flash Contents
+ *   each sector from adr on is rebuilt from the ops in buf and only
+ *   erased and programmed when it changes. Sectors larger than
+ *   CORE_DELTA_BUF are rebuilt twice, so they must not copy from themselves.
+ *    Parameter:      adr:  Start Address, on a sector boundary
+ *                    sz:   Size of the ops
+ *                    buf:  Ops
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramDelta (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	struct DeltaState d;
+	struct DeltaState first;
+	U32 size = 0;
+	U32 start = 0;
+	U32 off = 0;
+	U32 n = 0;
+	U32 i = 0;
+	U32 changed = 0;
+	U32 self = 0;
+
+	STATS_ENTER(STATS_PROGRAMDELTA);
+
+	d.in = buf;
+	d.end = buf + sz;
+	d.type = DELTA_DATA;
+	d.left = 0;
+	d.src = 0;
+	while((d.in != d.end) || (d.left != 0))
+	{
+		size = findSector(adr, &start);
+		if((size == 0) || (start != adr))
+		{
+			return STATS_LEAVE(STATS_PROGRAMDELTA, 1);
+		}
+		/*rebuild and compare*/
+		first = d;
+		changed = 0;
+		self = 0;
+		for(off = 0; off < size; off += n)
+		{
+			n = ((size - off) < CORE_DELTA_BUF) ? (size - off) : CORE_DELTA_BUF;
+			if(deltaRead(&d, adr + off, n, deltaBuf, adr, adr + size, &self) != 0)
+			{
+				return STATS_LEAVE(STATS_PROGRAMDELTA, 1);
+			}
+			for(i = 0; (i < n) && (changed == 0); i++)
+			{
+				changed = (deltaBuf[i] != *(const U8*)(adr + off + i)) ? 1 : 0;
+			}
+		}
+		if(changed != 0)
+		{
+			if(size > CORE_DELTA_BUF)
+			{
+				if(self != 0)
+				{
+					return STATS_LEAVE(STATS_PROGRAMDELTA, 1); // sector would read itself after erase
+				}
+				d = first;
+			}
+			if(EraseSector(adr) != 0)
+			{
+				return STATS_LEAVE(STATS_PROGRAMDELTA, 1);
+			}
+			for(off = 0; off < size; off += n)
+			{
+				n = ((size - off) < CORE_DELTA_BUF) ? (size - off) : CORE_DELTA_BUF;
+				if((size > CORE_DELTA_BUF) && (deltaRead(&d, adr + off, n, deltaBuf, adr, adr + size, &self) != 0))
+				{
+					return STATS_LEAVE(STATS_PROGRAMDELTA, 1);
+				}
+				if(ProgramPage(adr + off, n, deltaBuf) != 0)
+				{
+					return STATS_LEAVE(STATS_PROGRAMDELTA, 1);
+				}
+			}
+		}
+		adr += size;
+	}
+	return STATS_LEAVE(STATS_PROGRAMDELTA, 0);
+}
+
+#ifdef CORE_CR_SECTOR
+/*
+ *  get Sector number, counted through the sector table
+ *    Parameter:      addr:  flash address
+ *    Return Value:   sector number, 0xFFFFFFFF outside the flash
+ */
+static U32 getSector (U32 addr) {
+	const struct FlashSectors* pSector = flashSectors;
+	U32 sector = 0;
+	U32 start = 0;
+	U32 end = 0;
+
+	for(; pSector->szSector != 0xFFFFFFFF; pSector++)
+	{
+		start = coreSectorStart(pSector);
+		end = coreSectorStart(pSector + 1);
+		if((addr >= start) && (addr < end))
+		{
+			return sector + (addr - start) / pSector->szSector;
+		}
+		sector += (end - start) / pSector->szSector;
+	}
+	return 0xFFFFFFFF;
+}
+#endif
+
+/*
+ *  select a mass erase in CR
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int coreSelectChip (void) {
+	int result = coreBegin();
+
+	if(result == 0)
+	{
+		FLASH_CR_REG = (FLASH_CR_REG & ~CORE_CR_MASK) | CORE_CR_MASS;
+	}
+	return result;
+}
+
+/*
+ *  select the erase of a sector in CR
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int coreSelectSector (U32 adr) {
+	int result = coreBegin();
+
+	if(result != 0)
+	{
+		return result;
+	}
+#ifdef CORE_CR_SECTOR
+	FLASH_CR_REG = (FLASH_CR_REG & ~CORE_CR_MASK) | CORE_CR_ERASE | CORE_CR_SECTOR(getSector(adr));
+#else
+	FLASH_CR_REG = (FLASH_CR_REG & ~CORE_CR_MASK) | CORE_CR_ERASE;
+	FLASH_AR_REG = adr;
+#endif
+	return 0;
+}
+
+/*
+ *  start the erase selected in CR and return while it runs
+ *    Parameter:      adr:     Sector Address, device start for a mass erase
+ *                    bits:    CR bits set for the operation
+ *                    ms:      time out, checked by the host
+ *                    result:  of the selection, the erase fails unless 0
+ *    Return Value:   0 - started,  error code
+ */
+static int coreEraseStart (U32 adr, U32 bits, U32 ms, int result) {
+	CORE_MASS_ERASED(0);
+	EraseStatus.adr = adr;
+	EraseStatus.timeout = ms;
+	EraseStatus.result = result;
+	EraseStatus.done = 0;
+	EraseStatus.total = 1;
+	if(result != 0)
+	{
+		EraseStatus.state = ERASE_FAILED;
+		return result;
+	}
+	eraseBits = bits;
+	EraseStatus.state = ERASE_BUSY;
+	FLASH_CR_REG |= FLASH_CR_STRT;
+	return 0;
+}
+
+/*
+ *  Erase complete Flash Memory
+ *    Return Value:   0 - OK,  error code
+ */
+static int coreEraseChip (void) {
+	int result = coreSelectChip();
+
+	return (result != 0) ? result : coreStart(CORE_CR_MASS, FLASH_DEV_TO_ERASE * CORE_MASS_ERASE);
+}
+
+/*
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  error code
+ */
+static int coreEraseSector (U32 adr) {
+	int result = coreSelectSector(adr);
+
+	return (result != 0) ? result : coreStart(CORE_CR_ERASE, FLASH_DEV_TO_ERASE);
+}
+
+/*
+ *  Start a mass erase, EraseProgress polls it
+ *    Return Value:   0 - started,  error code
+ */
+static int coreEraseChipStart (void) {
+	return coreEraseStart(FLASH_DEV_ADDR, CORE_CR_MASS, FLASH_DEV_TO_ERASE * CORE_MASS_ERASE, coreSelectChip());
+}
+
+/*
+ *  Start a sector erase, EraseProgress polls it
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - started,  error code
+ */
+static int coreEraseSectorStart (U32 adr) {
+	return coreEraseStart(adr, CORE_CR_ERASE, FLASH_DEV_TO_ERASE, coreSelectSector(adr));
+}
+
+/*
+ *  Programming loop for one write width
+ *   name:   function name, int name (U32 adr, U32 sz, const U8* buf)
+ *   UNIT:   U8, U16, U32 or CORE_U64, buf is word aligned
+ *   bits:   CR bits set with PG, e.g. the F4 parallelism
+ *  PG stays set for the whole range, units that are erased in data and
+ *  flash are skipped and the others only wait for BSY. The error flags
+ *  stay set until cleared, SR is checked once at the end. A tail shorter
+ *  than a unit is padded with the erased value. Call coreBegin first.
+ *  Returns 0 or an error code.
+ */
+#define CORE_PROGRAM_LOOP(name, UNIT, bits)                                  \
+static int name (U32 adr, U32 sz, const U8* buf) {                           \
+	volatile UNIT* pDest = (volatile UNIT*)adr;                                \
+	const UNIT* pSrc = (const UNIT*)buf;                                       \
+	UNIT tail = (UNIT)~(UNIT)0;                                                \
+	U32 n = sz / sizeof(UNIT);                                                 \
+	U32 step = coreCycles(FLASH_DEV_TO_PROG) / (FLASH_DEV_PAGE / sizeof(UNIT)); \
+	U32 deadline = 0;                                                          \
+	U32 sr = 0;                                                                \
+	U32 i = 0;                                                                 \
+	U32 k = 0;                                                                 \
+	int result = 0;                                                            \
+                                                                             \
+	FLASH_CR_REG = (FLASH_CR_REG & ~CORE_CR_MASK) | FLASH_CR_PG | (bits);      \
+	coreTimerStart();                                                          \
+	for(i = 0; (i <= n) && (result == 0); i++, pDest++, pSrc++)               \
+	{                                                                          \
+		if(i == n)                                                               \
+		{                                                                        \
+			/*tail, padded with the erased value*/                                 \
+			if((sz % sizeof(UNIT)) == 0)                                           \
+			{                                                                      \
+				break;                                                               \
+			}                                                                      \
+			for(k = 0; k < sz % sizeof(UNIT); k++)                                 \
+			{                                                                      \
+				((U8*)&tail)[k] = ((const U8*)pSrc)[k];                              \
+			}                                                                      \
+			pSrc = &tail;                                                          \
+		}                                                                        \
+		/*an erased unit needs no write and no BSY wait*/                        \
+		if((*pSrc == (UNIT)~(UNIT)0) && (*pDest == (UNIT)~(UNIT)0))              \
+		{                                                                        \
+			SkippedUnits++;                                                        \
+			STATS_ADD(skipped, sizeof(UNIT));                                      \
+			continue;                                                              \
+		}                                                                        \
+		if(sizeof(UNIT) == 8)                                                    \
+		{                                                                        \
+			((volatile U32*)pDest)[0] = ((const U32*)pSrc)[0];                     \
+			ISB();                                                                 \
+			((volatile U32*)pDest)[1] = ((const U32*)pSrc)[1];                     \
+		}                                                                        \
+		else                                                                     \
+		{                                                                        \
+			*pDest = *pSrc;                                                        \
+		}                                                                        \
+		STATS_ADD(written, sizeof(UNIT));                                        \
+		/*each unit gets its share of the page time out*/                        \
+		deadline += step;                                                        \
+		result = coreWait(deadline, &sr);                                        \
+		if((result == 0) && ((sr & CORE_SR_ERRORS) != 0))                        \
+		{                                                                        \
+			result = coreResult(sr);                                               \
+		}                                                                        \
+		if((result == 0) && CORE_READBACK && (*pDest != *pSrc))                  \
+		{                                                                        \
+			result = FLASH_ERR_FAILED;                                             \
+		}                                                                        \
+	}                                                                          \
+	sr = FLASH_SR_REG;                                                         \
+	FLASH_CR_REG &= ~(FLASH_CR_PG | (bits));                                   \
+	FLASH_SR_REG = sr & CORE_SR_CLEAR;                                         \
+	return (result != 0) ? result : coreResult(sr);                           \
+}
+
+/*********************************************************************
+*
+*       Entry points shared by the families
+*/
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	const U32* p32Dest;
+	const U32* p32Src;
+	unsigned long n = 0;
+	unsigned long i = 0;
+
+	STATS_ENTER(STATS_VERIFY);
+
+	p32Dest = (const U32*)adr;
+	p32Src  = (const U32*)buf;
+	//
+	// compare word by word when both sides are 32-bit aligned,
+	// the byte loop below locates the failed byte and handles the tail
+	//
+	if(((adr | (U32)buf) & 3) == 0)
+	{
+		n = sz >> 2;
+	}
+	/*compare 4 words per loop*/
+	i = blockCompare(p32Dest, p32Src, n >> 2) << 2;
+	while(i < n)
+	{
+		if(p32Dest[i] != p32Src[i])
+		{
+			break;
+		}
+		i++;
+	}
+	/*byte compare*/
+	for(i <<= 2; i < sz; i++)
+	{
+		if(((const U8*)adr)[i] != buf[i])
+		{
+			break;
+		}
+	}
+
+  return (STATS_LEAVE(STATS_VERIFY, adr + i));   // Finished
+}
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+	const U32* p32Dest;
+	U32 pattern;
+	U32 n = 0;
+
+	STATS_ENTER(STATS_BLANKCHECK);
+
+	/*replicate pattern byte into a word*/
+	pattern = pat | ((U32)pat << 8);
+	pattern |= pattern << 16;
+
+	/*leading bytes up to word alignment*/
+	while((sz != 0) && ((adr & 3) != 0))
+	{
+		if(*(const U8*)adr != pat)
+		{
+			return STATS_LEAVE(STATS_BLANKCHECK, 1);
+		}
+		adr++;
+		sz--;
+	}
+	/*aligned blocks and words, stop at first non blank word*/
+	p32Dest = (const U32*)adr;
+	n = blockBlank(p32Dest, sz >> 4, pattern);
+	p32Dest += n << 2;
+	sz -= n << 4;
+	while(sz >= 4)
+	{
+		if(*p32Dest != pattern)
+		{
+			return STATS_LEAVE(STATS_BLANKCHECK, 1);
+		}
+		p32Dest++;
+		sz -= 4;
+	}
+	/*trailing bytes*/
+	adr = (unsigned long)p32Dest;
+	while(sz != 0)
+	{
+		if(*(const U8*)adr != pat)
+		{
+			return STATS_LEAVE(STATS_BLANKCHECK, 1);
+		}
+		adr++;
+		sz--;
+	}
+
+  return (STATS_LEAVE(STATS_BLANKCHECK, 0));     // Memory is blank
+}
+
+/*
+ *  State of the page started by ProgramPageStart, polled by the host
+ *  over the debug port while the core is running
+ */
+volatile struct PageStatus PageStatus = { PAGE_IDLE, 0, 0 };
+
+/*
+ *  Start programming a Page, pipelined mode
+ *   the host does not wait for the call to return, it loads the next page
+ *   into its second buffer while this one is written and polls PageStatus
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageStart (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	int result;
+
+	STATS_ENTER(STATS_PROGRAMSTART);
+
+	PageStatus.adr = adr;
+	PageStatus.buf = (unsigned long)buf;
+	PageStatus.state = PAGE_BUSY;
+
+	result = ProgramPage(adr, sz, buf);
+
+	PageStatus.state = (result == 0) ? PAGE_DONE : PAGE_FAILED;
+  return (STATS_LEAVE(STATS_PROGRAMSTART, result));
+}
+
+/*
+ *  Start erasing a Sector, background mode
+ *   returns once the erase runs, the host polls EraseProgress
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - started,  error code
+ */
+int EraseSectorStart (unsigned long adr) {
+  STATS_ENTER(STATS_ERASESECTORSTART);
+  return (STATS_LEAVE(STATS_ERASESECTORSTART, coreEraseSectorStart(adr)));
+}
+
+/*
+ *  Start erasing the complete Flash Memory, background mode
+ *    Return Value:   0 - started,  error code
+ */
+int EraseChipStart (void) {
+  STATS_ENTER(STATS_ERASECHIPSTART);
+  return (STATS_LEAVE(STATS_ERASECHIPSTART, coreEraseChipStart()));
+}
+
+/*
+ *  State of the erase started last, ends it once the flash is ready
+ *    Return Value:   ERASE_IDLE, ERASE_BUSY, ERASE_DONE, ERASE_FAILED
+ */
+int EraseProgress (void) {
+  return (coreEraseCheck());
+}
+
+/*
+ *  Erase all Sectors overlapping a Range of Flash Memory
+ *   walks the sector table (FlashDev.h) on the target, so the host
+ *   needs a single call instead of one EraseSector call per sector
+ *    Parameter:      start:  Start Address
+ *                    size:   Size (in bytes)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int EraseRange (unsigned long start, unsigned long size) {
+	U32 limit = FLASH_DEV_ADDR + FLASH_DEV_SIZE;
+	U32 adr = (start < FLASH_DEV_ADDR) ? FLASH_DEV_ADDR : start;
+	U32 last = 0;
+	U32 sz = 0;
+
+	STATS_ENTER(STATS_ERASERANGE);
+
+	/*end of the range, at most the end of the device, start + size may wrap*/
+	if(start < limit)
+	{
+		last = (size > limit - start) ? limit : start + size;
+	}
+	while(adr < last)
+	{
+		sz = findSector(adr, &adr);
+		if((sz == 0) || (EraseSector(adr) != 0))
+		{
+			return STATS_LEAVE(STATS_ERASERANGE, 1);
+		}
+		adr += sz;
+	}
+
+  return (STATS_LEAVE(STATS_ERASERANGE, 0));
+}
+
+/*
+ *  LZ4 decompression buffer, programmed with ProgramPage when full
+ */
+#define LZ4_CHUNK            256            // decompressed bytes per ProgramPage
+
+static U32 lz4Words[LZ4_CHUNK / 4];        // word aligned for ProgramPage
+#define lz4Buf ((U8*)lz4Words)
+static U32 lz4Adr;                          // flash address of lz4Buf[0]
+static U32 lz4Fill;                         // bytes in lz4Buf
+
+const U32 LZ4ChunkSize = LZ4_CHUNK;         // read by flash_algo_gen.py
+
+static int lz4Out (U8 b) {
+	lz4Buf[lz4Fill++] = b;
+	if(lz4Fill < LZ4_CHUNK)
+	{
+		return 0;
+	}
+	lz4Fill = 0;
+	lz4Adr += LZ4_CHUNK;
+	return ProgramPage(lz4Adr - LZ4_CHUNK, LZ4_CHUNK, lz4Buf);
+}
+
+/*
+ *  add the extension bytes of a literal or match length of 15
+ *  Return Value:   0 - OK,  1 - the stream ends inside the length
+ */
+static int lz4Length (const U8** in, const U8* end, U32* len) {
+	U8 b = 0;
+
+	if(*len != 15)
+	{
+		return 0;
+	}
+	do {
+		if(*in == end)
+		{
+			return 1;
+		}
+		b = *(*in)++;
+		*len += b;
+	} while(b == 255);
+	return 0;
+}
+
+/*
+ *  Program LZ4 compressed data
+ *   buf holds LZ4 block sequences, a sequence with offset 0 has no match
+ *   so the host can cut a stream after any sequence. Matches may reach
+ *   back into flash programmed before, by this or an earlier call. The
+ *   last chunk is padded with erased bytes up to CORE_LZ4_PAD.
+ *    Parameter:      adr:  Start Address of the decompressed data
+ *                    sz:   Size of the compressed data
+ *                    buf:  Compressed data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageLZ4 (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	const U8* in = buf;
+	const U8* end = buf + sz;
+	U32 len = 0;
+	U32 off = 0;
+	U8 token = 0;
+	U8 b = 0;
+
+	STATS_ENTER(STATS_PROGRAMLZ4);
+
+	lz4Adr = adr;
+	lz4Fill = 0;
+	while(in < end)
+	{
+		/*literals*/
+		token = *in++;
+		len = token >> 4;
+		if((lz4Length(&in, end, &len) != 0) || (len > (U32)(end - in)))
+		{
+			return STATS_LEAVE(STATS_PROGRAMLZ4, 1); // truncated stream
+		}
+		for(; len != 0; len--)
+		{
+			if(lz4Out(*in++) != 0)
+			{
+				return STATS_LEAVE(STATS_PROGRAMLZ4, 1);
+			}
+		}
+		if(in == end)
+		{
+			break;                              // last sequence, no match
+		}
+		/*match, copied from lz4Buf or from flash*/
+		if((end - in) < 2)
+		{
+			return STATS_LEAVE(STATS_PROGRAMLZ4, 1);
+		}
+		off = in[0] | (in[1] << 8);
+		in += 2;
+		len = token & 15;
+		if(lz4Length(&in, end, &len) != 0)
+		{
+			return STATS_LEAVE(STATS_PROGRAMLZ4, 1);
+		}
+		if(off == 0)
+		{
+			continue;
+		}
+		for(len += 4; len != 0; len--)
+		{
+			b = (off <= lz4Fill) ? lz4Buf[lz4Fill - off] : *(const U8*)(lz4Adr - (off - lz4Fill));
+			if(lz4Out(b) != 0)
+			{
+				return STATS_LEAVE(STATS_PROGRAMLZ4, 1);
+			}
+		}
+	}
+	if(lz4Fill == 0)
+	{
+		return STATS_LEAVE(STATS_PROGRAMLZ4, 0);
+	}
+	while((lz4Fill % CORE_LZ4_PAD) != 0)
+	{
+		lz4Buf[lz4Fill++] = FLASH_DEV_EMPTY;
+	}
+	return STATS_LEAVE(STATS_PROGRAMLZ4, ProgramPage(lz4Adr, lz4Fill, lz4Buf));
+}
+
+/*
+ *  Update programming: a sector is only erased when the new data cannot
+ *  be programmed over what the flash holds now. updateUnit of the
+ *  algorithm classifies a unit of CORE_UPDATE_UNIT bytes.
+ */
+#define UPDATE_SAME          0              // unit unchanged
+#define UPDATE_PROGRAM       1              // unit can be programmed in place
+#define UPDATE_ERASE         2              // unit needs an erase
+
+#ifndef CORE_UPDATE_PROGRAM
+#define CORE_UPDATE_PROGRAM  ProgramPage
+#endif
+
+static int updateUnit (const U8* flash, const U8* data);
+
+/*
+ *  Program Page in update mode
+ *   the range is compared with the flash sector by sector. Changed units
+ *   that the flash accepts without an erase are programmed in place,
+ *   otherwise the sector is erased and programmed, partly covered sectors
+ *   are merged with their current contents in deltaBuf first.
+ *    Parameter:      adr:  Start Address, aligned to CORE_UPDATE_UNIT
+ *                    sz:   Size, a multiple of CORE_UPDATE_UNIT
+ *                    buf:  Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int ProgramPageUpdate (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	U32 unit = CORE_UPDATE_UNIT;
+	U32 start = 0;
+	U32 size = 0;
+	U32 len = 0;
+	U32 i = 0;
+	U32 run = 0;
+	U32 erase = 0;
+
+	STATS_ENTER(STATS_PROGRAMUPDATE);
+
+	if(((adr % unit) != 0) || ((sz % unit) != 0))
+	{
+		return STATS_LEAVE(STATS_PROGRAMUPDATE, 1);
+	}
+	while(sz != 0)
+	{
+		size = findSector(adr, &start);
+		if(size == 0)
+		{
+			return STATS_LEAVE(STATS_PROGRAMUPDATE, 1);
+		}
+		len = ((start + size - adr) < sz) ? (start + size - adr) : sz;
+		/*can every changed unit be programmed in place*/
+		erase = 0;
+		for(i = 0; (i < len) && (erase == 0); i += unit)
+		{
+			erase = (updateUnit((const U8*)(adr + i), buf + i) == UPDATE_ERASE) ? 1 : 0;
+		}
+		if(erase == 0)
+		{
+			/*program the runs of changed units*/
+			for(i = 0; i < len; i += run + unit)
+			{
+				for(run = 0; (i + run < len) && (updateUnit((const U8*)(adr + i + run), buf + i + run) == UPDATE_PROGRAM); run += unit);
+				if((run != 0) && (CORE_UPDATE_PROGRAM(adr + i, run, buf + i) != 0))
+				{
+					return STATS_LEAVE(STATS_PROGRAMUPDATE, 1);
+				}
+			}
+		}
+		else if((adr == start) && (len == size))
+		{
+			if((EraseSector(start) != 0) || (ProgramPage(start, size, buf) != 0))
+			{
+				return STATS_LEAVE(STATS_PROGRAMUPDATE, 1);
+			}
+		}
+		else if(size <= CORE_DELTA_BUF)
+		{
+			/*keep the rest of the sector*/
+			copyBytes(deltaBuf, (const U8*)start, size);
+			copyBytes(deltaBuf + (adr - start), buf, len);
+			if((EraseSector(start) != 0) || (ProgramPage(start, size, deltaBuf) != 0))
+			{
+				return STATS_LEAVE(STATS_PROGRAMUPDATE, 1);
+			}
+		}
+		else
+		{
+			return STATS_LEAVE(STATS_PROGRAMUPDATE, 1); // sector does not fit in deltaBuf
+		}
+		adr += len;
+		buf += len;
+		sz -= len;
+	}
+	return STATS_LEAVE(STATS_PROGRAMUPDATE, 0);
+}
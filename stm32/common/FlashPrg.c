@@ -15,6 +15,7 @@
  */
 
 #include "../../FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"             // Flash Layout, from the device folder
 
 #define U8  unsigned char
 #define U16 unsigned short
@@ -69,21 +70,97 @@
 #define FLASH_UNLOCK_KEY2      0xCDEF89AB
 
 
+/*********************************************************************
+*
+*      Driver core descriptor, see FlashCore.h
+*/
+#define CORE_SR_ERRORS         (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)
+#define CORE_SR_CLEAR          (FLASH_SR_PGERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP)
+#define CORE_SR_PROTECTED      FLASH_SR_WRPRTERR
+#define CORE_CR_MASS           FLASH_CR_MER
+#define CORE_CR_ERASE          FLASH_CR_PER  // sector address in FLASH_AR_REG
+#define CORE_CR_MASK           0
+#define CORE_READBACK          0             // PGERR: halfword was not erased
+#define CORE_CLK_MAX           72000000      // F1 and F3, F0 runs at 48 MHz
+#define CORE_LZ4_PAD           2             // halfword programming
+#define CORE_DELTA_BUF         2048          // largest sector
+#define CORE_UPDATE_UNIT       2             // halfword programming
 
-	
 
 /*
- *  Unlock the flash
- *    Parameter:      None
- *    Return Value:   0 - OK,  
+ *  Sector table, same as FlashDevice.sectors in FlashDev.c
  */
- int UnlockFlash(void) {
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY1;
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY2;
-    return 0;
- }
+static const struct FlashSectors flashSectors[] = {
+  FLASH_SECTORS
+  SECTOR_END
+};
 
+/*
+ *  Write units skipped by ProgramPage since Init because the data and
+ *  the flash both hold the erased value, the host reads it for statistics
+ */
+volatile U32 SkippedUnits = 0;
+
+#include "FlashCore.h"            // Driver core, after the descriptor
 
+/*
+ *  halfword programming
+ */
+CORE_PROGRAM_LOOP(programHalfwords, U16, 0)
+
+
+/*********************************************************************
+*
+*      CRC-32 (IEEE 802.3) lookup table, reflected polynomial 0xEDB88320
+*/
+static const U32 crcTable[256] = {
+	0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+	0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+	0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+	0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+	0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+	0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+	0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+	0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+	0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+	0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+	0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+	0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+	0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+	0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+	0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+	0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+	0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+	0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+	0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+	0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+	0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+	0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+	0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+	0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+	0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+	0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+	0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+	0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+	0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+	0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+	0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+	0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+	0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+	0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+	0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+	0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+	0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+	0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+	0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+	0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+	0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+	0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+	0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+
+	
 
 /*
  *  Initialize Flash Programming Functions
@@ -98,7 +175,11 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
 	//
 	/*clear SR*/
 	FLASH_SR_REG = FLASH_SR_PGERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP;
-  return (0);
+	SkippedUnits = 0;
+	coreTimerInit(clk);
+	STATS_CLEAR();
+	STATS_ENTER(STATS_INIT);
+  return (STATS_LEAVE(STATS_INIT, 0));
 }
 
 /*
@@ -108,165 +189,113 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
-	//
-	// No special uninit necessary
-	//
-  return (0);
+	int result;
+
+	STATS_ENTER(STATS_UNINIT);
+	result = STATS_LEAVE(STATS_UNINIT, 0);
+	/*SysTick of the time outs, after the last sample*/
+	coreTimerStop();
+  return (result);
 }
 
 /*
  *  Erase complete Flash Memory
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseChip (void) {
-
-	U32 cr = 0;
-	U32 sr = 0;
-	
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
-	{
-		UnlockFlash();
-	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-	
-	/*first set MER bit, then set STRT bit*/
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_MER;
-	FLASH_CR_REG = cr;
-	
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-
-	/*clear MER bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_MER;
-	FLASH_CR_REG = cr;
-	
-
-  return (0);                                    // Finished without Errors
+  STATS_ENTER(STATS_ERASECHIP);
+  return (STATS_LEAVE(STATS_ERASECHIP, coreEraseChip()));
 }
 
 /*
  *  Erase Sector in Flash Memory
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseSector (unsigned long adr) {
-	U32 cr = 0;
-	U32 sr = 0;
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
-	{
-		UnlockFlash();
-	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
-	
-	/*first set PER bit, then set address, last set STRT bit*/
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_PER;
-	FLASH_CR_REG = cr;
-	
-	/*set erase sector address*/
-	FLASH_AR_REG = adr; 
-	
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-
-	/*clear PER bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_PER;
-	FLASH_CR_REG = cr;	
-
-  return (0);
+  STATS_ENTER(STATS_ERASESECTOR);
+  return (STATS_LEAVE(STATS_ERASESECTOR, coreEraseSector(adr)));
 }
 
 /*
  *  Program Page in Flash Memory
+ *   PG stays set for the whole page and each halfword only waits for
+ *   BSY. A failed halfword (not erased, write protected) sets PGERR or
+ *   WRPRTERR, which ends the page with FLASH_ERR_FAILED or
+ *   FLASH_ERR_PROTECTED. Verify reads the data back in a separate pass.
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-  volatile U16* pDest;
-  volatile U16* pSrc;
-  U32 NumWords;
-  U32 Status;
-	U32 cr = 0;
-	U32 sr = 0;
+	int result = 0;
+
+	STATS_ENTER(STATS_PROGRAMPAGE);
+
+	// buf is always 32-bit aligned, made sure by CMSIS-DAP firmware
+	result = coreBegin();
+	if(result != 0)
+	{
+		return (STATS_LEAVE(STATS_PROGRAMPAGE, result));
+	}
+	return (STATS_LEAVE(STATS_PROGRAMPAGE, programHalfwords(adr, sz, buf)));
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long ComputeCRC (unsigned long adr, unsigned long sz) {
+	const U32* p32Src;
+	U32 crc = 0xFFFFFFFF;
+	unsigned long n = 0;
 	unsigned long i = 0;
-	U16 data;
-	
-  pDest = (volatile U16*)adr;
-  pSrc = (volatile U16*)buf;    // Always 32-bit aligned. Made sure by CMSIS-DAP firmware
-	//
-	// adr is always aligned to "Programming Page Size" specified in table in FlashDev.c
-  // sz is always a multiple of "Programming Page Size"
-	//
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+
+	STATS_ENTER(STATS_COMPUTECRC);
+
+	p32Src = (const U32*)adr;
+	if((adr & 3) == 0)
+	{
+		n = sz >> 2;
+	}
+	/*one word load, 4 table lookups*/
+	while(i < n)
+	{
+		crc ^= p32Src[i];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		crc = (crc >> 8) ^ crcTable[crc & 0xFF];
+		i++;
+	}
+	/*remaining bytes*/
+	for(i <<= 2; i < sz; i++)
 	{
-		UnlockFlash();
+		crc = (crc >> 8) ^ crcTable[(crc ^ ((const U8*)adr)[i]) & 0xFF];
 	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
 
-	while(i < sz/2 )
+  return (STATS_LEAVE(STATS_COMPUTECRC, ~crc));
+}
+
+/*
+ *  Update programming, see FlashCore.h
+ *   A halfword can be programmed when it is erased, and to 0x0000 at any
+ *   time (PM0075), so config blocks that only clear halfwords need no erase.
+ */
+static int updateUnit (const U8* flash, const U8* data) {
+	U16 old = *(const U16*)flash;
+	U16 val = *(const U16*)data;
+
+	if(old == val)
 	{
-		/*first set PG bit in CR, then write data to flash address*/
-		cr = FLASH_CR_REG;
-		cr |= FLASH_CR_PG;
-		FLASH_CR_REG = cr;
-		
-		*pDest = *pSrc;
-		/*wait SR BSY cleared*/
-		do{
-			sr = FLASH_SR_REG;
-		}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-		
-		/*check program word is ok*/
-		if(*pSrc != *pDest)
-		{
-			/*clear PG bit*/
-			cr = FLASH_CR_REG;
-			cr &= ~FLASH_CR_PG;
-			FLASH_CR_REG = cr;	
-			
-			return 1;
-		}
-		pDest++;
-		pSrc++;
-		i++;	
+		return UPDATE_SAME;
 	}
-	
-	/*clear PG bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_PG;
-	FLASH_CR_REG = cr;		
-	
-  return (0);                                  // Finished without Errors
+	return ((old == 0xFFFF) || (val == 0x0000)) ? UPDATE_PROGRAM : UPDATE_ERASE;
 }
+
+#ifdef FLASH_AGENT
+#include "../../FlashAgent.h"     // Resident agent, after the entry points
+#endif
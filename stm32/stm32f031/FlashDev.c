@@ -15,20 +15,21 @@
  */
 
 #include "../../FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"             // Flash Layout
 
 struct FlashDevice const FlashDevice  =  {
    FLASH_DRV_VERS,             // Driver Version, do not modify!
    "STM32F031 32 KB Flash",    // Device Name
    ONCHIP,                     // Device Type
-   0x08000000,                 // Flash start address
-   0x00008000,                 // Flash total size (32KB )
-   1024,                       // Programming Page Size
+   FLASH_DEV_ADDR,             // Flash start address
+   FLASH_DEV_SIZE,             // Flash total size (32KB )
+   FLASH_DEV_PAGE,             // Programming Page Size
    0,                          // Reserved, must be 0
-   0xFF,                       // Initial Content of Erased Memory
-   500,                        // Program Page Timeout 100 mSec
-   5000,                       // Erase Sector Timeout 3000 mSec
+   FLASH_DEV_EMPTY,            // Initial Content of Erased Memory
+   FLASH_DEV_TO_PROG,          // Program Page Timeout in mSec
+   FLASH_DEV_TO_ERASE,         // Erase Sector Timeout in mSec
 	
 							   // Specify Size and Address of Sectors
-  0x00000400, 0x00000000,     // Sector Size  1 KB (32 Sectors)
+  FLASH_SECTORS
   SECTOR_END                  // Marks end of sector table
 };
@@ -0,0 +1,30 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  STM32F031 flash layout, used by FlashDev.c for the device description
+ *  and by FlashPrg.c to walk the sectors on the target
+ */
+#define FLASH_DEV_ADDR       0x08000000    // Flash start address
+#define FLASH_DEV_SIZE       0x00008000    // Flash total size (32KB )
+#define FLASH_DEV_PAGE       1024          // Programming page size
+#define FLASH_DEV_EMPTY      0xFF          // Content of erased flash
+#define FLASH_DEV_TO_PROG    500           // Program page time out in ms
+#define FLASH_DEV_TO_ERASE   5000          // Erase sector time out in ms
+
+                                         // Size and Address of Sectors
+#define FLASH_SECTORS \
+  0x00000400, 0x00000000,                /* Sector Size  1 KB (32 Sectors) */
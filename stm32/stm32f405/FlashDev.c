@@ -15,22 +15,21 @@
  */
 
 #include "../../FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"             // Flash Layout
 
 struct FlashDevice const FlashDevice  =  {
    FLASH_DRV_VERS,             // Driver Version, do not modify!
    "STM32F405OG 1024 KB Flash",  // Device Name
    ONCHIP,                     // Device Type
-   0x08000000,                 // Flash start address
-   0x00100000,                 // Flash total size (1MB )
-   512,                        // Programming Page Size. 16K
+   FLASH_DEV_ADDR,             // Flash start address
+   FLASH_DEV_SIZE,             // Flash total size (1MB )
+   FLASH_DEV_PAGE,             // Programming Page Size. 16K
    0,                          // Reserved, must be 0
-   0xFF,                       // Initial Content of Erased Memory
-   1000,                        // Program Page Timeout 1000 mSec
-   10000,                       // Erase Sector Timeout 10000 mSec
+   FLASH_DEV_EMPTY,            // Initial Content of Erased Memory
+   FLASH_DEV_TO_PROG,           // Program Page Timeout in mSec
+   FLASH_DEV_TO_ERASE,          // Erase Sector Timeout in mSec
 	
 															  // Specify Size and Address of Sectors
-  0x00004000, 0x08000000,       // Sector Size  16KB (4 Sectors)
-  0x00010000, 0x08010000,       // Sector Size  64KB (1 Sectors)
-  0x00020000, 0x08020000,       // Sector Size  128KB(7 Sectors)
+  FLASH_SECTORS
   SECTOR_END                    // Marks end of sector table
 };
@@ -15,6 +15,7 @@
  */
 
 #include "../../FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"             // Flash Layout
 
 #define U8  unsigned char
 #define U16 unsigned short
@@ -37,6 +38,10 @@
 #define FLASH_CR_REG         (*(volatile unsigned long *)0x40023C10)
 #define FLASH_OPTCR_REG      (*(volatile unsigned long *)0x40023C14)
 
+#define CRC_DR_REG           (*(volatile unsigned long *)0x40023000)
+#define CRC_CR_REG           (*(volatile unsigned long *)0x40023008)
+#define RCC_AHB1ENR_REG      (*(volatile unsigned long *)0x40023830)
+
 	
 
 /*********************************************************************
@@ -71,6 +76,14 @@
 #define FLASH_CR_STRT        0x00010000
 #define FLASH_CR_LOCK        0x80000000
 
+/*********************************************************************
+*
+*      CRC unit bit definitions
+*/
+#define CRC_CR_RESET         0x00000001
+#define RCC_AHB1ENR_CRCEN    0x00001000
+#define CRC32_POLY_REFLECTED 0xEDB88320
+
 
 
 
@@ -83,46 +96,69 @@
 #define FLASH_UNLOCK_KEY2      0xCDEF89AB
 
 
+/*********************************************************************
+*
+*      Driver core descriptor, see FlashCore.h
+*/
+#define CORE_SR_ERRORS         (FLASH_SR_OPERR | FLASH_SR_WRPRTERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+#define CORE_SR_CLEAR          (CORE_SR_ERRORS | FLASH_SR_EOP)
+#define CORE_SR_PROTECTED      FLASH_SR_WRPRTERR
+#define CORE_CR_MASS           (FLASH_CR_MER | programSize)
+#define CORE_CR_ERASE          (FLASH_CR_SER | programSize)
+#define CORE_CR_SECTOR(n)      ((n) << FLASH_CR_SNB_SHIFT)
+#define CORE_CR_MASK           (FLASH_CR_SNB_MASK | FLASH_CR_SIZE_MASK)
+#define CORE_READBACK          1             // a unit that was not erased is not flagged
+#define CORE_CLK_MAX           168000000
+#define CORE_LZ4_PAD           8             // up to x64 parallelism
+#define CORE_DELTA_BUF         4096
+#define CORE_UPDATE_UNIT       (1UL << (programSize >> 8))   // bytes per write
+
+
 /*
- *  get Sector number 
- *   STM32F045:   0x08000000 - 0x08010000: 4 sector/16KB
-									0x08010000 - 0x08020000: 1 sector/64KB
-									0x08020000 - 0x08100000: 7 sector/128KB									
- *    Parameter:      addr:  flash address
- *    Return Value:   sector: 0 - 11
+ *  Sector table, same as FlashDevice.sectors in FlashDev.c
  */
+static const struct FlashSectors flashSectors[] = {
+  FLASH_SECTORS
+  SECTOR_END
+};
+
+/*
+ *  Write units skipped by ProgramPage since Init because the data and
+ *  the flash both hold the erased value, the host reads it for statistics
+ */
+volatile U32 SkippedUnits = 0;
 
-unsigned long getSector (unsigned long addr) {
-		unsigned long sector = 0xFFFFFFFF;
-		if(addr >= 0x08000000 && addr < 0x08010000)
-		{
-			sector = (addr - 0x08000000)/0x00004000;
-		}
-		else if(addr >= 0x08010000 && addr < 0x08020000)
-		{
-			sector = 4;
-		}
-		else if(addr >= 0x08020000 && addr < 0x08100000)
-		{
-			sector = 5 + (addr - 0x08020000)/0x00020000;
-		}
-		return sector;
-}
-	
-	
 
 /*
- *  Unlock the flash
- *    Parameter:      None
- *    Return Value:   0 - OK,  
+ *  program/erase parallelism (FLASH_CR PSIZE), set by SetParallelism
+ *   x32 needs VDD 2.7 - 3.6V, x64 needs external VPP
  */
- int UnlockFlash(void) {
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY1;
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY2;
-    return 0;
- }
+static U32 programSize = FLASH_CR_32_SIZE;
 
 
+#include "../common/FlashCore.h"      // Driver core, after the descriptor
+
+/*
+ *  programming loops for each parallelism
+ */
+CORE_PROGRAM_LOOP(programBytes, U8, FLASH_CR_8_SIZE)
+CORE_PROGRAM_LOOP(programHalfwords, U16, FLASH_CR_16_SIZE)
+CORE_PROGRAM_LOOP(programWords, U32, FLASH_CR_32_SIZE)
+CORE_PROGRAM_LOOP(programDoubleWords, CORE_U64, FLASH_CR_64_SIZE)
+
+
+/*
+ *  reverse bit order of a word
+ *    Parameter:      v:  word
+ *    Return Value:   v with bit 0 swapped with bit 31, bit 1 with bit 30 ...
+ */
+static U32 reverseBits (U32 v) {
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+	v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+	return (v >> 16) | (v << 16);
+}
 
 /*
  *  Initialize Flash Programming Functions
@@ -137,7 +173,11 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
 	//
 	/*clear SR*/
 	FLASH_SR_REG = FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP;
-  return (0);
+	SkippedUnits = 0;
+	coreTimerInit(clk);
+	STATS_CLEAR();
+	STATS_ENTER(STATS_INIT);
+  return (STATS_LEAVE(STATS_INIT, 0));
 }
 
 /*
@@ -147,200 +187,152 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
-	//
-	// No special uninit necessary
-	//
-  return (0);
+	int result;
+
+	STATS_ENTER(STATS_UNINIT);
+	result = STATS_LEAVE(STATS_UNINIT, 0);
+	/*SysTick of the time outs, after the last sample*/
+	coreTimerStop();
+  return (result);
 }
 
 
 
 /*
  *  Erase complete Flash Memory
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseChip (void) {
-
-	U32 cr = 0;
-	U32 sr = 0;
-	
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
-	{
-		UnlockFlash();
-	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-	
-	/*first clear PG size, set MER bit, then set STRT bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_SIZE_MASK;
-	cr |= FLASH_CR_MER;
-	FLASH_CR_REG = cr;
-	
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-
-	/*clear MER bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_MER;
-	FLASH_CR_REG = cr;
-	
-
-  return (0);                                    // Finished without Errors
+  STATS_ENTER(STATS_ERASECHIP);
+  return (STATS_LEAVE(STATS_ERASECHIP, coreEraseChip()));
 }
 
 /*
  *  Erase Sector in Flash Memory
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseSector (unsigned long adr) {
-	U32 cr = 0;
-	U32 sr = 0;
-	unsigned long sector = 0;
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+  STATS_ENTER(STATS_ERASESECTOR);
+  return (STATS_LEAVE(STATS_ERASESECTOR, coreEraseSector(adr)));
+}
+
+/*
+ *  Select program/erase parallelism
+ *   used by EraseChip, EraseSector and ProgramPage, default x32
+ *    Parameter:      psize:  8, 16, 32 or 64 (x64 needs external VPP)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+int SetParallelism (unsigned long psize) {
+	switch(psize)
 	{
-		UnlockFlash();
+		case 8:  programSize = FLASH_CR_8_SIZE;  break;
+		case 16: programSize = FLASH_CR_16_SIZE; break;
+		case 32: programSize = FLASH_CR_32_SIZE; break;
+		case 64: programSize = FLASH_CR_64_SIZE; break;
+		default: return 1;
 	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
-	
-	/*first set SER bit, erase sector, last set STRT bit*/
-	sector = getSector(adr);	
-	cr = FLASH_CR_REG;
-	cr &= ~(FLASH_CR_SIZE_MASK | FLASH_CR_SNB_MASK);
-	cr |= (FLASH_CR_SER | (sector << FLASH_CR_SNB_SHIFT) | FLASH_CR_32_SIZE);
-	FLASH_CR_REG = cr;
-	 
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-
-	/*clear SER bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_SER;
-	FLASH_CR_REG = cr;	
-
   return (0);
 }
 
 /*
  *  Program Page in Flash Memory
+ *   with the loop of the selected parallelism, each unit is read back
+ *   since programming bits that are not erased sets no error flag
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-  volatile U32* p32Dest;
-  volatile U32* p32Src;
-  volatile U16* p16Dest;
-  volatile U16* p16Src;
-	U32 cr = 0;
-	U32 sr = 0;
+	int result = 0;
+
+	STATS_ENTER(STATS_PROGRAMPAGE);
+
+	// buf is always 32-bit aligned, made sure by CMSIS-DAP firmware
+	result = coreBegin();
+	if(result != 0)
+	{
+		return (STATS_LEAVE(STATS_PROGRAMPAGE, result));
+	}
+	switch(programSize)
+	{
+		case FLASH_CR_64_SIZE: return (STATS_LEAVE(STATS_PROGRAMPAGE, programDoubleWords(adr, sz, buf)));
+		case FLASH_CR_32_SIZE: return (STATS_LEAVE(STATS_PROGRAMPAGE, programWords(adr, sz, buf)));
+		case FLASH_CR_16_SIZE: return (STATS_LEAVE(STATS_PROGRAMPAGE, programHalfwords(adr, sz, buf)));
+		default:               return (STATS_LEAVE(STATS_PROGRAMPAGE, programBytes(adr, sz, buf)));
+	}
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *   the CRC unit computes the MSB first CRC, so words are fed bit reversed
+ *   and the result is reversed back to get the reflected CRC-32.
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long ComputeCRC (unsigned long adr, unsigned long sz) {
+	const U32* p32Src;
+	U32 crc;
+	unsigned long n = 0;
 	unsigned long i = 0;
-	
-  p32Dest = (volatile U32*)adr;
-  p32Src = (volatile U32*)buf;    // Always 32-bit aligned. Made sure by CMSIS-DAP firmware
-	//
-	// adr is always aligned to "Programming Page Size" specified in table in FlashDev.c
-  // sz is always a multiple of "Programming Page Size"
-	//
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+
+	STATS_ENTER(STATS_COMPUTECRC);
+
+	p32Src = (const U32*)adr;
+	if((adr & 3) == 0)
 	{
-		UnlockFlash();
+		n = sz >> 2;
 	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
-
-	//clear Program size
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_SIZE_MASK;
-	FLASH_CR_REG = cr;
-	
-	while(i < sz/4 )
+	/*enable CRC unit clock, reset CRC to 0xFFFFFFFF*/
+	RCC_AHB1ENR_REG |= RCC_AHB1ENR_CRCEN;
+	CRC_CR_REG = CRC_CR_RESET;
+
+	while(i < n)
 	{
-		/*first set PG bit/Program size: 32bit in CR, then write data to flash address*/
-		cr = FLASH_CR_REG;
-		cr |= (FLASH_CR_PG | FLASH_CR_32_SIZE);
-		FLASH_CR_REG = cr;
-		
-		*p32Dest = *p32Src;
-		/*wait SR BSY cleared*/
-		do{
-			sr = FLASH_SR_REG;
-		}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-		
-		/*check program word is ok*/
-		if(*p32Src != *p32Dest)
+		CRC_DR_REG = reverseBits(p32Src[i]);
+		i++;
+	}
+	crc = reverseBits(CRC_DR_REG);
+
+	/*remaining bytes in software*/
+	for(i <<= 2; i < sz; i++)
+	{
+		crc ^= ((const U8*)adr)[i];
+		for(n = 0; n < 8; n++)
 		{
-			/*clear PG bit*/
-			cr = FLASH_CR_REG;
-			cr &= ~(FLASH_CR_PG | FLASH_CR_SIZE_MASK);
-			FLASH_CR_REG = cr;	
-			
-			return 1;
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY_REFLECTED : 0);
 		}
-		p32Dest++;
-		p32Src++;
-		i++;	
 	}
-	//half word
-	if(sz%4 != 0)
+
+  return (STATS_LEAVE(STATS_COMPUTECRC, ~crc));
+}
+
+/*
+ *  Update programming, see FlashCore.h
+ *   Without ECC any bit can go from 1 to 0 in place, a unit only needs an
+ *   erase when a bit has to go from 0 to 1.
+ */
+static int updateUnit (const U8* flash, const U8* data) {
+	U32 n = CORE_UPDATE_UNIT;
+	int state = UPDATE_SAME;
+
+	for(; n != 0; n--, flash++, data++)
 	{
-		p16Dest = (volatile U16*)p32Dest;
-		p16Src  = (volatile U16*)p32Src;
-		/*set PG bit/Program size: 16 bit in CR, then write data to flash address*/
-		cr = FLASH_CR_REG;
-		cr &= ~FLASH_CR_SIZE_MASK;
-		cr |= (FLASH_CR_PG | FLASH_CR_16_SIZE);
-		FLASH_CR_REG = cr;
-		
-		*p16Dest = *p16Src;
-		/*wait SR BSY cleared*/
-		do{
-			sr = FLASH_SR_REG;
-		}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-		
-		/*check program word is ok*/
-		if(*p16Src != *p16Dest)
+		if(*flash == *data)
 		{
-			/*clear PG bit*/
-			cr = FLASH_CR_REG;
-			cr &= ~(FLASH_CR_PG | FLASH_CR_SIZE_MASK);
-			FLASH_CR_REG = cr;	
-			
-			return 1;
-		}		
-	}	
-	
-	/*clear PG bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~(FLASH_CR_PG | FLASH_CR_SIZE_MASK);
-	FLASH_CR_REG = cr;		
-	
-  return (0);                                  // Finished without Errors
+			continue;
+		}
+		if((*flash & *data) != *data)
+		{
+			return UPDATE_ERASE;
+		}
+		state = UPDATE_PROGRAM;
+	}
+	return state;
 }
+
+#ifdef FLASH_AGENT
+#include "../../FlashAgent.h"     // Resident agent, after the entry points
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include "../../FlashOS.H"        // FlashOS Structures
+#include "FlashDev.h"             // Flash Layout
 
 #define U8  unsigned char
 #define U16 unsigned short
@@ -36,6 +37,12 @@
 #define FLASH_SR_REG         (*(volatile unsigned long *)0x40022010)
 #define FLASH_CR_REG         (*(volatile unsigned long *)0x40022014)
 
+#define CRC_DR_REG           (*(volatile unsigned long *)0x40023000)
+#define CRC_CR_REG           (*(volatile unsigned long *)0x40023008)
+#define CRC_INIT_REG         (*(volatile unsigned long *)0x40023010)
+#define CRC_POL_REG          (*(volatile unsigned long *)0x40023014)
+#define RCC_AHB1ENR_REG      (*(volatile unsigned long *)0x40021048)
+
 
 	
 
@@ -73,8 +80,23 @@
 #define FLASH_CR_MER2        0x00008000
 
 #define FLASH_CR_STRT        0x00010000
+#define FLASH_CR_FSTPG       0x00040000
 #define FLASH_CR_LOCK        0x80000000
 
+#define FLASH_ROW_SIZE       256            // fast programming: 32 double words
+#define FLASH_SR_ERRORS      (FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPRTERR | FLASH_SR_PGAERR | FLASH_SR_SIZEERR | FLASH_SR_PGSERR | FLASH_SR_MISEERR | FLASH_SR_FASTERR)
+
+/*********************************************************************
+*
+*      CRC unit bit definitions
+*/
+#define CRC_CR_RESET         0x00000001
+#define CRC_CR_REV_IN_WORD   0x00000060
+#define CRC_CR_REV_OUT       0x00000080
+#define CRC32_POLY           0x04C11DB7
+#define CRC32_POLY_REFLECTED 0xEDB88320
+#define RCC_AHB1ENR_CRCEN    0x00001000
+
 
 
 
@@ -87,29 +109,70 @@
 #define FLASH_UNLOCK_KEY2      0xCDEF89AB
 
 
+/*********************************************************************
+*
+*      Driver core descriptor, see FlashCore.h
+*/
+#define CORE_SR_ERRORS         FLASH_SR_ERRORS
+#define CORE_SR_CLEAR          (FLASH_SR_ERRORS | FLASH_SR_OPTVERR | FLASH_SR_RDERR | FLASH_SR_EOP)
+#define CORE_SR_PROTECTED      FLASH_SR_WRPRTERR
+#define CORE_CR_MASS           (FLASH_CR_MER1 | FLASH_CR_MER2)
+#define CORE_CR_ERASE          FLASH_CR_PER
+#define CORE_CR_SECTOR(n)      ((((n) & 0xFF) << FLASH_CR_SNB_SHIFT) | (((n) & 0x100) ? FLASH_CR_BANK2 : FLASH_CR_BANK1))
+#define CORE_CR_MASK           (FLASH_CR_SNB_MASK | FLASH_CR_BANK2)
+#define CORE_READBACK          0             // PROGERR: double word was not erased
+#define CORE_CLK_MAX           80000000
+#define CORE_LZ4_PAD           8             // double word programming
+#define CORE_DELTA_BUF         2048          // page size
+#define CORE_UPDATE_UNIT       8             // double word programming
+#define CORE_UPDATE_PROGRAM    programInPlace
+#define CORE_MASS_ERASED(m)    (massErased = (m))
+
+
 /*
- *  get Sector number 
- *   STM32L476:   0x08000000 - 0x080100000: 512 sector/2KB						
- *    Parameter:      addr:  flash address
- *    Return Value:   sector: 0 - 511
+ *  Sector table, same as FlashDevice.sectors in FlashDev.c
  */
+static const struct FlashSectors flashSectors[] = {
+  FLASH_SECTORS
+  SECTOR_END
+};
 
-unsigned long getSector (unsigned long addr) {
-    return (addr - 0x08000000) >> 11;
-}
-	
-	
+/*
+ *  Write units (8-byte double words) skipped by ProgramPage since Init
+ *  because the data and the flash both hold the erased value, the host
+ *  reads it for statistics. A skipped fast programming row counts all of
+ *  its double words.
+ */
+volatile U32 SkippedUnits = 0;
 
 /*
- *  Unlock the flash
- *    Parameter:      None
- *    Return Value:   0 - OK,  
+ *  Per bank progress of ProgramPageDual since Init, read by the host
  */
- int UnlockFlash(void) {
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY1;
-    FLASH_KEYR_REG = FLASH_UNLOCK_KEY2;
-    return 0;
- }
+struct BankProgress {
+	U32 programmed;                           // bytes programmed
+	U32 verified;                             // bytes read back and matched
+	U32 failed;                               // first failed address, 0 if none
+};
+
+volatile struct BankProgress BankProgress[2];
+
+
+/*
+ *  set when a mass erase ends without error, cleared when any erase
+ *  starts (CORE_MASS_ERASED). fast programming (FSTPG) is only allowed
+ *  on mass erased banks
+ */
+static U32 massErased = 0;
+
+static int verifyPending (void);            // dual bank programming, see below
+static int programInPlace (unsigned long adr, unsigned long sz, unsigned char *buf); // update programming
+
+#include "../common/FlashCore.h"      // Driver core, after the descriptor
+
+/*
+ *  double word programming, the standard sequence
+ */
+CORE_PROGRAM_LOOP(programDoubleWords, CORE_U64, 0)
 
 /*
  *  clear the flash error flags
@@ -119,7 +182,7 @@ unsigned long getSector (unsigned long addr) {
 void clearErrorFlags(void)
 {
 	/*clear SR*/
-	FLASH_SR_REG = FLASH_SR_OPTVERR | FLASH_SR_RDERR | FLASH_SR_FASTERR | FLASH_SR_MISEERR | FLASH_SR_PGSERR | FLASH_SR_SIZEERR | FLASH_SR_PGAERR | FLASH_SR_WRPRTERR | FLASH_SR_PROGERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP;
+	FLASH_SR_REG = CORE_SR_CLEAR;
 }
 
 /*
@@ -134,7 +197,14 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
 	// No special init necessary
 	//
     clearErrorFlags();
-    return (0);
+    SkippedUnits = 0;
+    BankProgress[0].programmed = BankProgress[1].programmed = 0;
+    BankProgress[0].verified = BankProgress[1].verified = 0;
+    BankProgress[0].failed = BankProgress[1].failed = 0;
+    coreTimerInit(clk);
+    STATS_CLEAR();
+    STATS_ENTER(STATS_INIT);
+    return (STATS_LEAVE(STATS_INIT, 0));
 }
 
 /*
@@ -144,111 +214,111 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
+    int result = 0;
+
+    STATS_ENTER(STATS_UNINIT);
+
 	//
-	// No special uninit necessary
+	// verify the last page of dual bank programming
 	//
-    return (0);
+    result = STATS_LEAVE(STATS_UNINIT, verifyPending());
+    coreTimerStop();                           // after the last sample
+    return (result);
 }
 
 
 
 /*
  *  Erase complete Flash Memory
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseChip (void) {
-
-	U32 cr = 0;
-	U32 sr = 0;
-	
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
-	{
-		UnlockFlash();
-	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-	
-    //clear all error flag
-    clearErrorFlags();
-    
-	/*first set MER1/MER2 bit, then set STRT bit*/
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_MER1 | FLASH_CR_MER2;
-	FLASH_CR_REG = cr;
-	
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-
-	/*clear MER1/MER2 bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~ (FLASH_CR_MER1 | FLASH_CR_MER2);
-	FLASH_CR_REG = cr;
-	
-
-    return (0);                                    // Finished without Errors
+    STATS_ENTER(STATS_ERASECHIP);
+    return (STATS_LEAVE(STATS_ERASECHIP, coreEraseChip()));
 }
 
 /*
  *  Erase Sector in Flash Memory
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int EraseSector (unsigned long adr) {
-	U32 cr = 0;
+    STATS_ENTER(STATS_ERASESECTOR);
+    return (STATS_LEAVE(STATS_ERASESECTOR, coreEraseSector(adr)));
+}
+
+/*
+ *  Program rows of 32 double words in fast programming mode
+ *   only valid after a mass erase, the double words of a row are
+ *   written back to back and the result is checked from SR once per row
+ *    Parameter:      adr:  Row Start Address, 256 byte aligned
+ *                    rows: Number of rows
+ *                    buf:  Data
+ *    Return Value:   0 - OK,  error code
+ */
+static int programRows (unsigned long adr, unsigned long rows, unsigned char *buf) {
+    volatile U32* p32Dest;
+    const U32* p32Src;
+	U32 step = coreCycles(FLASH_DEV_TO_PROG) / (FLASH_DEV_PAGE / FLASH_ROW_SIZE);
+	U32 deadline = 0;
 	U32 sr = 0;
-	unsigned long sector = 0;
-    U32 blank = FLASH_CR_BANK1;
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+	unsigned long i = 0;
+    int result = 0;
+
+    p32Dest = (volatile U32*)adr;
+    p32Src  = (const U32*)buf;
+
+    /*set FSTPG bit*/
+    FLASH_CR_REG |= FLASH_CR_FSTPG;
+    coreTimerStart();
+
+	while(rows != 0)
 	{
-		UnlockFlash();
+		/*an erased row is skipped as a whole, the bank is mass erased*/
+		for(i = 0; (i < FLASH_ROW_SIZE/4) && (p32Src[i] == 0xFFFFFFFF); i++);
+		if(i == FLASH_ROW_SIZE/4)
+		{
+			SkippedUnits += FLASH_ROW_SIZE/8;
+			STATS_ADD(skipped, FLASH_ROW_SIZE);
+			p32Dest += FLASH_ROW_SIZE/4;
+			p32Src  += FLASH_ROW_SIZE/4;
+			rows--;
+			continue;
+		}
+		/*64 words without interruption*/
+		for(i = 0; i < FLASH_ROW_SIZE/4; i++)
+		{
+			p32Dest[i] = p32Src[i];
+		}
+
+		STATS_ADD(written, FLASH_ROW_SIZE);
+
+		/*wait SR BSY cleared, each row gets its share of the page time out*/
+		deadline += step;
+		result = coreWait(deadline, &sr);
+		if(result != 0)
+		{
+			break;
+		}
+
+		/*row failed: error flags instead of EOP*/
+		if((sr & FLASH_SR_ERRORS) != 0)
+		{
+			result = coreResult(sr);
+			clearErrorFlags();
+			break;
+		}
+		FLASH_SR_REG = FLASH_SR_EOP;
+
+		p32Dest += FLASH_ROW_SIZE/4;
+		p32Src  += FLASH_ROW_SIZE/4;
+		rows--;
 	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
-	
-    //clear all error flag
-    clearErrorFlags();
-    
-	/*first set PER bit, erase sector, last set STRT bit*/
-	sector = getSector(adr);
-    if (sector >= 0x100) {
-        blank = FLASH_CR_BANK2;
-        sector = sector & 0x000000FF;
-    }
-        
-	cr = FLASH_CR_REG;
-	cr &= ~ (FLASH_CR_SNB_MASK | FLASH_CR_BANK2);
-	cr |= (FLASH_CR_PER | (sector << FLASH_CR_SNB_SHIFT) | blank);
-	FLASH_CR_REG = cr;
-	 
-	cr = FLASH_CR_REG;
-	cr |= FLASH_CR_STRT;
-	FLASH_CR_REG = cr;	
-	
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
 
-	/*clear PER bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~FLASH_CR_PER;
-	FLASH_CR_REG = cr;	
+    /*clear FSTPG bit*/
+    FLASH_CR_REG &= ~FLASH_CR_FSTPG;
 
-    return (0);
+    return result;
 }
 
 /*
@@ -256,82 +326,324 @@ int EraseSector (unsigned long adr) {
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
  *                    buf:  Page Data
- *    Return Value:   0 - OK,  1 - Failed
+ *    Return Value:   0 - OK,  error code
  */
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-    volatile U32* p32Dest;
-    volatile U32* p32Src;
+    unsigned long done = 0;
+    int result = 0;
 
-	U32 cr = 0;
-	U32 sr = 0;
+    STATS_ENTER(STATS_PROGRAMPAGE);
+
+    // buf is always 32-bit aligned, made sure by CMSIS-DAP firmware
+    result = coreBegin();
+    if(result != 0)
+    {
+        return STATS_LEAVE(STATS_PROGRAMPAGE, result);
+    }
+
+    //after EraseChip whole rows are written in fast programming mode,
+    //the remaining double words with the standard sequence
+    if((massErased != 0) && ((adr & (FLASH_ROW_SIZE - 1)) == 0))
+    {
+        done = (sz / FLASH_ROW_SIZE) * FLASH_ROW_SIZE;
+        result = programRows(adr, sz / FLASH_ROW_SIZE, buf);
+        if(result != 0)
+        {
+            return STATS_LEAVE(STATS_PROGRAMPAGE, result);
+        }
+    }
+    if(done == sz)
+    {
+        return STATS_LEAVE(STATS_PROGRAMPAGE, 0);
+    }
+    return (STATS_LEAVE(STATS_PROGRAMPAGE, programDoubleWords(adr + done, sz - done, buf + done)));
+}
+
+/*
+ *  Compute CRC-32 (IEEE 802.3, same as zlib crc32) of Flash Memory
+ *   the CRC unit reverses input words and output, so DR holds the reflected CRC
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC-32 value
+ */
+unsigned long ComputeCRC (unsigned long adr, unsigned long sz) {
+	const U32* p32Src;
+	U32 crc;
+	unsigned long n = 0;
 	unsigned long i = 0;
-    unsigned long left = (sz%8 != 0) ? 1 : 0;
-    
-	
-    p32Dest = (volatile U32*)(adr & 0xFFFFFFF8); // aligned at 64-bit
-    p32Src  = (volatile U32*)(buf);    // Always 32-bit aligned. Made sure by CMSIS-DAP firmware
-    
-    //
-	// adr is always aligned to "Programming Page Size" specified in table in FlashDev.c
-    // sz is always a multiple of "Programming Page Size"
-	//
-	/*check flash is locked, if yes, unlock it*/
-	cr = FLASH_CR_REG;
-	if( (cr & FLASH_CR_LOCK) == FLASH_CR_LOCK)
+
+	STATS_ENTER(STATS_COMPUTECRC);
+
+	p32Src = (const U32*)adr;
+	if((adr & 3) == 0)
 	{
-		UnlockFlash();
+		n = sz >> 2;
 	}
-	/*wait SR BSY cleared*/
-	do{
-		sr = FLASH_SR_REG;
-	}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);	
+	/*enable CRC unit clock, 32-bit polynomial, bit reversed in/out*/
+	RCC_AHB1ENR_REG |= RCC_AHB1ENR_CRCEN;
+	CRC_INIT_REG = 0xFFFFFFFF;
+	CRC_POL_REG = CRC32_POLY;
+	CRC_CR_REG = CRC_CR_RESET | CRC_CR_REV_IN_WORD | CRC_CR_REV_OUT;
 
-    //clear all error flag
-    clearErrorFlags();
-    
+	while(i < n)
+	{
+		CRC_DR_REG = p32Src[i];
+		i++;
+	}
+	crc = CRC_DR_REG;
 
-	while(i < (sz/8 + left))
+	/*remaining bytes in software*/
+	for(i <<= 2; i < sz; i++)
 	{
-        /*set PG bit*/
-        cr = FLASH_CR_REG;
-        cr |= FLASH_CR_PG;
-        FLASH_CR_REG = cr;
-	
-		//first word
-        *p32Dest++ = *p32Src++;
-        //second word
-        *p32Dest++ = *p32Src++;
-        
-		/*wait SR BSY cleared*/
-		do{
-			sr = FLASH_SR_REG;
-		}while((sr & FLASH_SR_BSY) == FLASH_SR_BSY);
-        
-        /*check EOP, clear it */
-        sr = FLASH_SR_REG;
-        if((sr & FLASH_SR_EOP) == FLASH_SR_EOP)
-        {    
-            FLASH_SR_REG =  FLASH_SR_EOP;
-        }
-        
-		/*check program word is ok*/
-		if((*(p32Src - 2) != *(p32Dest - 2)) || (*(p32Src - 1) != *(p32Dest - 1)))
+		crc ^= ((const U8*)adr)[i];
+		for(n = 0; n < 8; n++)
 		{
-			/*clear PG bit*/
-			cr = FLASH_CR_REG;
-			cr &= ~ FLASH_CR_PG ;
-			FLASH_CR_REG = cr;	
-			
-			return 1;
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY_REFLECTED : 0);
 		}
+	}
+
+  return (STATS_LEAVE(STATS_COMPUTECRC, ~crc));
+}
 
-		i++;	
+/*
+ *  Update programming, see FlashCore.h
+ *   Each double word carries ECC, it can only be programmed when it is
+ *   erased, or to all zero at any time.
+ */
+static int updateUnit (const U8* flash, const U8* data) {
+	const U32* old = (const U32*)flash;
+	const U32* val = (const U32*)data;
+
+	if((old[0] == val[0]) && (old[1] == val[1]))
+	{
+		return UPDATE_SAME;
 	}
-	
-	/*clear PG bit*/
-	cr = FLASH_CR_REG;
-	cr &= ~ FLASH_CR_PG ;
-	FLASH_CR_REG = cr;		
-	
-  return (0);                                  // Finished without Errors
+	if(((old[0] & old[1]) == 0xFFFFFFFF) || ((val[0] | val[1]) == 0))
+	{
+		return UPDATE_PROGRAM;
+	}
+	return UPDATE_ERASE;
+}
+
+/*
+ *  in place writes use the standard sequence, fast programming needs
+ *  erased rows
+ */
+static int programInPlace (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	U32 erased = massErased;
+	int result = 0;
+
+	massErased = 0;
+	result = ProgramPage(adr, sz, buf);
+	massErased = erased;
+	return result;
+}
+
+/*
+ *  Dual bank programming: the host alternates the pages it sends between
+ *  the two banks. While a page is erased or programmed in one bank, the
+ *  page programmed before in the other bank is read back (read-while-write),
+ *  so the verify does not add to the programming time. The last page is
+ *  verified by UnInit.
+ */
+#define FLASH_BANK_SIZE      0x00080000     // 512 KB per bank
+#define FLASH_PAGE_SIZE      0x00000800
+#define VERIFY_STEP          32             // bytes compared per SR poll
+
+static U32 verifyWords[2][FLASH_PAGE_SIZE / 4]; // copies of the pending and the current page
+static U32 verifyBuf = 0;                   // verifyWords of the pending page
+static U32 verifyAdr = 0;
+static U32 verifySize = 0;                  // 0 - nothing to verify
+static U32 verifyOff = 0;
+static U32 verifyFailed = 0;
+
+static U32 getBank (U32 adr) {
+	return ((adr - FLASH_DEV_ADDR) >= FLASH_BANK_SIZE) ? 1 : 0;
 }
+
+/*
+ *  compare the next VERIFY_STEP bytes of the pending page
+ */
+static void verifyStep (void) {
+	U32 bank = getBank(verifyAdr);
+	U32 end = verifyOff + VERIFY_STEP;
+
+	if(end > verifySize)
+	{
+		end = verifySize;
+	}
+	for(; verifyOff < end; verifyOff += 4)
+	{
+		if(*(const U32*)(verifyAdr + verifyOff) != verifyWords[verifyBuf][verifyOff / 4])
+		{
+			if(BankProgress[bank].failed == 0)
+			{
+				BankProgress[bank].failed = verifyAdr + verifyOff;
+			}
+			verifyFailed = 1;
+			verifySize = 0;
+			return;
+		}
+		BankProgress[bank].verified += 4;
+	}
+}
+
+/*
+ *  finish the pending verify
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+static int verifyPending (void) {
+	int result = 0;
+
+	while(verifyOff < verifySize)
+	{
+		verifyStep();
+	}
+	result = verifyFailed;
+	verifyFailed = 0;
+	verifySize = 0;
+	return result;
+}
+
+/*
+ *  wait for BSY, verifying the other bank meanwhile
+ *    Parameter:      deadline:  cycles since coreTimerStart
+ *                    sr:        set to the last SR read
+ *    Return Value:   0 - OK,  FLASH_ERR_TIMEOUT
+ */
+static int waitVerify (U32 deadline, U32* sr) {
+	int result = 0;
+#ifdef FLASH_STATS
+	U32 start = coreClock();
+#endif
+
+	while(((*sr = FLASH_SR_REG) & FLASH_SR_BSY) == FLASH_SR_BSY)
+	{
+		STATS_ADD(busyPolls, 1);
+		if(coreTimer() >= deadline)
+		{
+			result = FLASH_ERR_TIMEOUT;
+			break;
+		}
+		verifyStep();
+	}
+#ifdef FLASH_STATS
+	FlashStats.busyCycles += coreClock() - start;
+#endif
+	return result;
+}
+
+/*
+ *  Program Page in dual bank mode
+ *   the page is erased unless blank and programmed double word by double
+ *   word into the verifyWords copy the pending page does not use. The
+ *   previous page is verified while the flash is busy with the erase and
+ *   each double word when it is in the other bank, before this page is
+ *   written otherwise.
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size, a multiple of 8 up to FLASH_PAGE_SIZE
+ *                    buf:  Page Data, word aligned
+ *    Return Value:   0 - OK,  error code (this page or the previous one)
+ */
+int ProgramPageDual (unsigned long adr, unsigned long sz, unsigned char *buf) {
+	const U32* src = (const U32*)buf;
+	volatile U32* dst = (volatile U32*)adr;
+	U32 bank = getBank(adr);
+	U32* copy = verifyWords[verifyBuf ^ 1];
+	U32 step = coreCycles(FLASH_DEV_TO_PROG) / (FLASH_DEV_PAGE / 8);
+	U32 deadline = 0;
+	U32 sr = 0;
+	U32 i = 0;
+	int result = 0;
+
+	STATS_ENTER(STATS_PROGRAMDUAL);
+
+	if(((adr & (FLASH_PAGE_SIZE - 1)) != 0) || (sz > FLASH_PAGE_SIZE) || ((sz & 7) != 0))
+	{
+		return STATS_LEAVE(STATS_PROGRAMDUAL, 1);
+	}
+	result = coreBegin();
+	if(result != 0)
+	{
+		return STATS_LEAVE(STATS_PROGRAMDUAL, result);
+	}
+	/*a page of the same bank cannot be read while this one is written*/
+	if((verifySize != 0) && (getBank(verifyAdr) == bank) && (verifyPending() != 0))
+	{
+		return STATS_LEAVE(STATS_PROGRAMDUAL, 1);
+	}
+	/*erase unless blank*/
+	for(i = 0; (i < FLASH_PAGE_SIZE / 4) && (((const U32*)adr)[i] == 0xFFFFFFFF); i++);
+	if(i < FLASH_PAGE_SIZE / 4)
+	{
+		massErased = 0;
+		FLASH_CR_REG = (FLASH_CR_REG & ~CORE_CR_MASK) | CORE_CR_ERASE | CORE_CR_SECTOR(getSector(adr));
+		FLASH_CR_REG |= FLASH_CR_STRT;
+		coreTimerStart();
+		result = waitVerify(coreCycles(FLASH_DEV_TO_ERASE), &sr);
+		FLASH_CR_REG &= ~FLASH_CR_PER;
+		FLASH_SR_REG = FLASH_SR_EOP;
+		if((result == 0) && ((sr & FLASH_SR_ERRORS) != 0))
+		{
+			result = coreResult(sr);
+			clearErrorFlags();
+		}
+		if(result != 0)
+		{
+			return STATS_LEAVE(STATS_PROGRAMDUAL, result);
+		}
+	}
+	FLASH_CR_REG |= FLASH_CR_PG;
+	coreTimerStart();
+	for(i = 0; (i < sz / 4) && (result == 0); i += 2)
+	{
+		copy[i] = src[i];
+		copy[i + 1] = src[i + 1];
+		if((src[i] & src[i + 1]) == 0xFFFFFFFF)
+		{
+			SkippedUnits++;
+			STATS_ADD(skipped, 8);
+			continue;
+		}
+		dst[i] = src[i];
+		dst[i + 1] = src[i + 1];
+		STATS_ADD(written, 8);
+		deadline += step;
+		result = waitVerify(deadline, &sr);
+		if((result == 0) && ((sr & FLASH_SR_ERRORS) != 0))
+		{
+			result = coreResult(sr);
+		}
+	}
+	sr = FLASH_SR_REG;
+	FLASH_CR_REG &= ~FLASH_CR_PG;
+	FLASH_SR_REG = FLASH_SR_EOP;
+	if(result == 0)
+	{
+		result = coreResult(sr);
+	}
+	if(result != 0)
+	{
+		clearErrorFlags();
+		if(BankProgress[bank].failed == 0)
+		{
+			BankProgress[bank].failed = adr;
+		}
+		return STATS_LEAVE(STATS_PROGRAMDUAL, result);
+	}
+	BankProgress[bank].programmed += sz;
+	/*the rest of the previous page, the flash is idle now*/
+	if(verifyPending() != 0)
+	{
+		return STATS_LEAVE(STATS_PROGRAMDUAL, 1);
+	}
+	verifyBuf ^= 1;
+	verifyAdr = adr;
+	verifySize = sz;
+	verifyOff = 0;
+	return STATS_LEAVE(STATS_PROGRAMDUAL, 0);
+}
+
+#ifdef FLASH_AGENT
+#include "../../FlashAgent.h"     // Resident agent, after the entry points
+#endif
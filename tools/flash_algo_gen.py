@@ -15,28 +15,69 @@ See the License for the specific language governing permissions and
 limitations under the License.
 
 
-This script takes as input an .axf file containing the flash algorithm to be
+This script takes as input an ELF file containing the flash algorithm to be
 loaded in the target RAM and it converts it to a binary array ready to be
 included in the CMSIS-DAP Interface Firmware source code.
+
+The ELF file is read directly, no fromelf is needed: Keil .axf and GCC .axf
+or .elf files of the Cortex-M algorithms (PrgCode, PrgData and DevDscr
+regions of Target.lin) and the RISC-V gd32vf103.elf. Several files are
+converted in parallel, each into its own outputs, and a result is cached by
+the hash of the ELF file, so an unchanged algorithm costs a file copy.
+
+Usage:
+    flash_algo_gen.py [-j JOBS] [-s START] [-c CACHE] [--no-cache] [algo.axf ...]
+
+Every algo.axf gives
+    algo.txt        the blob and TARGET_FLASH table for the firmware
+    algo.blob       the blob as loaded at ALGO_START
+    algo.json       descriptor for hosts that load the blob themselves:
+                    load_address, entry_offsets, data and constants, and
+                    stack_top and page_buffers when the linker script has
+                    them (gd32vf103)
+    algo_DevDscr    the FlashDevice structure of the Cortex-M algorithms,
+                    read by flash_delta.py and friends
+Without files TMP_DIR/flash_algo.axf gives TMP_DIR/flash_algo.txt and the
+others, with TMP_DIR/DevDscr.
 """
-from struct import unpack
-from os.path import join
+from __future__ import print_function
+
+import hashlib
+import json
+import os
+from multiprocessing import Pool
+from optparse import OptionParser
+from os.path import join, exists, splitext
+from struct import pack, unpack, unpack_from
 
-from utils import run_cmd
-from settings import *
 from paths import TMP_DIR
 
 
 # INPUT
 ALGO_ELF_PATH = join(TMP_DIR, "flash_algo.axf")
 
-ALGO_OFFSET = 0x20
+# Entry points exported in the TARGET_FLASH function table, in table order
+ALGO_FUNCTIONS = ['Init', 'UnInit', 'EraseChip', 'EraseSector', 'ProgramPage', 'Verify', 'BlankCheck', 'ComputeCRC',
+                  'ProgramPageStart', 'EraseRange',
+                  'SetParallelism', 'ProgramPageLZ4', 'ProgramDelta',
+                  'ProgramPageUpdate', 'ProgramPageDual',
+                  'EraseSectorStart', 'EraseChipStart', 'EraseProgress', 'RunAgent']
+
+# State blocks in algorithm RAM the host reads while the algorithm runs
+ALGO_DATA = ['PageStatus', 'SkippedUnits', 'BankProgress', 'FlashStats', 'EraseStatus', 'AgentQueue']
+
+# Constants in the algorithm code the host needs, emitted with their value
+ALGO_CONSTANTS = ['LZ4ChunkSize', 'DeltaBufSize']
 
-# OUTPUT
-TMP_DIR_W_TERM = TMP_DIR + '/'
+# Stack and page buffers of an algorithm with its own runtime (gd32vf103),
+# placed past the blob by its linker script
+ALGO_RUNTIME = ['StackTop', 'PageBuffer0', 'PageBuffer1', 'AlgoEnd']
+
+# OUTPUT: C table, blob as loaded, descriptor, next to the ELF file, and
+# DevDscr, the FlashDevice structure of the Cortex-M algorithms
+OUTPUTS = ['txt', 'blob', 'json']
 DEV_INFO_PATH = join(TMP_DIR, "DevDscr")
-ALGO_BIN_PATH = join(TMP_DIR, "PrgCode")
-ALGO_TXT_PATH = join(TMP_DIR, "flash_algo.txt")
+CACHE_DIR = join(TMP_DIR, "algo_cache")
 
 # Algorithm start addresses for each TARGET (compared with DevName in the
 # FlashDevice structure in FlashDev.c
@@ -51,119 +92,326 @@ ALGO_START_ADDRESSES = {
     'LPC4337':  0x10000000,
     'MKXX':     0x20000000,
     'nRF51822AA':   0x20000000,
-    'STM32F103RC':  0x20000000,	
+    'STM32F103RC':  0x20000000,
     'STM32F051':    0x20000000,
-    'STM32F405':    0x20000000,	
+    'STM32F405':    0x20000000,
     'STM32F071':    0x20000000,
-    'STM32F031':    0x20000000,	
+    'STM32F031':    0x20000000,
     'STM32L486':    0x20000000,
     'STM32F301K8':    0x20000000,
     'LPC11U35':    0x10000000,
 }
 
-class FlashInfo(object):
-    def __init__(self, path):
-        with open(path, "rb") as f:
-            # Read Device Information struct (defined in FlashOS.H, declared in FlashDev.c).
-            self.version  = unpack("H", f.read(2))[0]
-            self.devName  = f.read(128).split(b'\0',1)[0]
-            self.devType  = unpack("H", f.read(2))[0]
-            self.devAddr  = unpack("L", f.read(4))[0]
-            self.szDev    = unpack("L", f.read(4))[0]
-            self.szPage   = unpack("L", f.read(4))[0]
-            skipped = f.read(4)
-            self.valEmpty = unpack("B", f.read(1))[0]
-            skipped = f.read(3)
-            self.toProg   = unpack("L", f.read(4))[0]
-            self.toErase  = unpack("L", f.read(4))[0]
-            self.sectSize = []
-            self.sectAddr = []
-            while 1:
-                addr = unpack("L", f.read(4))[0]
-                size = unpack("L", f.read(4))[0]
-                if addr == 0xffffffff:
-                    break
-                elif size == 0xffffffff:
-                    break
-                else:
-                    self.sectSize.append(size)
-                    self.sectAddr.append(addr)
+# Per ELF machine: ALGO_START when there is no FlashDevice to match
+# (gd32vf103 has none), offset of the algorithm behind the blob header
+EM_ARM = 40
+EM_RISCV = 243
+MACHINES = {
+    EM_ARM:   {'name': 'Cortex-M', 'start': 0x20000000, 'offset': 0x20},
+    EM_RISCV: {'name': 'RISC-V',   'start': 0x20000000, 'offset': 0},
+}
 
+# Cortex-M blob header: breakpoint the algorithm returns to, then a helper
+BLOB_HEADER = [0xE00ABE00, 0x062D780D, 0x24084068, 0xD3000040, 0x1E644058, 0x1C49D1FA, 0x2A001E52, 0x4770D1F2]
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+STT_NOTYPE = 0
+STT_OBJECT = 1
+STT_FUNC = 2
+STB_LOCAL = 0
+
+
+class FlashInfo(object):
+    def __init__(self, path=None, data=None):
+        if data is None:
+            with open(path, "rb") as f:
+                data = f.read()
+        # Read Device Information struct (defined in FlashOS.H, declared in FlashDev.c).
+        self.version  = unpack_from("<H", data, 0)[0]
+        self.devName  = data[2:130].split(b'\0',1)[0]
+        self.devType  = unpack_from("<H", data, 130)[0]
+        self.devAddr  = unpack_from("<L", data, 132)[0]
+        self.szDev    = unpack_from("<L", data, 136)[0]
+        self.szPage   = unpack_from("<L", data, 140)[0]
+        self.valEmpty = unpack_from("<B", data, 148)[0]
+        self.toProg   = unpack_from("<L", data, 152)[0]
+        self.toErase  = unpack_from("<L", data, 156)[0]
+        self.sectSize = []
+        self.sectAddr = []
+        offset = 160
+        while offset + 8 <= len(data):
+            # struct FlashSectors: szSector first, then AddrSector
+            size, addr = unpack_from("<LL", data, offset)
+            if size == 0xffffffff or addr == 0xffffffff:
+                break
+            self.sectSize.append(size)
+            self.sectAddr.append(addr)
+            offset += 8
 
     def get_algo_start(self):
         # Search the DevName part of the FlashDevice description (FlashDev.c)
         # for anything matching the ALGO_START_ADDRESSES dictionary
         for target in ALGO_START_ADDRESSES:
-            if target in self.devName:
-                print 'Identified target as %s' % (target)
-                return ALGO_START_ADDRESSES[target]
-        print 'Found no match in ALGO_START_ADDRESSES for "%s"' % (self.devName)
-        raise Error()
+            if target.encode() in self.devName:
+                return target, ALGO_START_ADDRESSES[target]
+        raise ValueError('Found no match in ALGO_START_ADDRESSES for "%s"' % self.devName.decode())
 
     def printInfo(self):
-        print "Extracted device information:"
-        print "----------------------------"
-        print "Version:        0x%04x" % (self.version)
-        print "Device Name:    %s" % (self.devName)
-        print "Device Type:    %u" % (self.devType)
-        print "Device Address: 0x%08x" % (self.devAddr)
-        print "Device Size:    0x%08x" % (self.szDev)
-        print "Prog Page Size: %u" % (self.szPage)
-        print "valEmpty:       0x%02x" % (self.valEmpty)
-        print "Timeout Prog:   %u" % (self.toProg)
-        print "Timeout Erase:  %u" % (self.toErase)
+        print("Extracted device information:")
+        print("----------------------------")
+        print("Version:        0x%04x" % (self.version))
+        print("Device Name:    %s" % (self.devName.decode()))
+        print("Device Type:    %u" % (self.devType))
+        print("Device Address: 0x%08x" % (self.devAddr))
+        print("Device Size:    0x%08x" % (self.szDev))
+        print("Prog Page Size: %u" % (self.szPage))
+        print("valEmpty:       0x%02x" % (self.valEmpty))
+        print("Timeout Prog:   %u" % (self.toProg))
+        print("Timeout Erase:  %u" % (self.toErase))
         for i in range(len(self.sectSize)):
-            print "Sectors[%d]: { 0x%08x, 0x%08x }" % (i, self.sectSize[i], self.sectAddr[i])
-
-
-def gen_flash_algo():
-    run_cmd([FROMELF, '--bin', ALGO_ELF_PATH, '-o', TMP_DIR_W_TERM])
-    try:
-        flash_info = FlashInfo(DEV_INFO_PATH)
-        ALGO_START = flash_info.get_algo_start()
-    except IOError, e:
-        print repr(e), e
-        ALGO_START = 0x20000000
-    print "ALGO_START = 0x%08x\n" % ALGO_START
-
-    #flash_info.printInfo()
-
-    with open(ALGO_BIN_PATH, "rb") as f, open(ALGO_TXT_PATH, mode="w+") as res:
-        # Flash Algorithm
-        res.write("""
-const uint32_t flash_algo_blob[] = {
-    0xE00ABE00, 0x062D780D, 0x24084068, 0xD3000040, 0x1E644058, 0x1C49D1FA, 0x2A001E52, 0x4770D1F2,
-    """);
-
-        nb_bytes = ALGO_OFFSET
-
-        bytes_read = f.read(1024)
-        while bytes_read:
-            bytes_read = unpack(str(len(bytes_read)/4) + 'I', bytes_read)
-            for i in range(len(bytes_read)):
-                res.write(("0x%08x" % bytes_read[i]) + ", ")
-                nb_bytes += 4
-                if (nb_bytes % 0x20) == 0:
-                    res.write("\n    ") # % nb_bytes)
-            bytes_read = f.read(1024)
-        
-        res.write("\n};\n")
-        
-        # Address of the functions within the flash algorithm
-        stdout, _, _ = run_cmd([FROMELF, '-s', ALGO_ELF_PATH])
-        res.write("""
-static const TARGET_FLASH flash = {
-""")
-        for line in stdout.splitlines():
-            t = line.strip().split()
-            if len(t) != 8: continue
-            name, loc = t[1], t[2]
-            
-            if name in ['Init', 'UnInit', 'EraseChip', 'EraseSector', 'ProgramPage']:
-                addr = ALGO_START + ALGO_OFFSET + int(loc, 16)
-                res.write("    0x%08X, // %s\n" % (addr,  name))
+            print("Sectors[%d]: { 0x%08x, 0x%08x }" % (i, self.sectSize[i], self.sectAddr[i]))
 
 
-if __name__ == '__main__':
-    gen_flash_algo()
+class ElfFile(object):
+    # Sections and symbols of a little endian ELF32 file
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF' or data[4:6] != b'\x01\x01':
+            raise ValueError('not a little endian ELF32 file')
+        self.data = data
+        (self.machine,) = unpack_from('<H', data, 18)
+        (shoff,) = unpack_from('<I', data, 32)
+        shentsize, shnum, shstrndx = unpack_from('<HHH', data, 46)
+        self.sections = []
+        for i in range(shnum):
+            name, type, flags, addr, offset, size, link = unpack_from('<IIIIIII', data, shoff + i * shentsize)
+            self.sections.append({'name': name, 'type': type, 'flags': flags, 'addr': addr,
+                                  'offset': offset, 'size': size, 'link': link})
+        strtab = self.sections[shstrndx]
+        for s in self.sections:
+            s['name'] = self._string(strtab, s['name'])
+
+    def _string(self, strtab, index):
+        start = strtab['offset'] + index
+        return self.data[start:self.data.index(b'\0', start)].decode()
+
+    def section(self, name):
+        for s in self.sections:
+            if s['name'] == name:
+                return s
+        return None
+
+    def contents(self, s):
+        if s['type'] == SHT_NOBITS:
+            return b'\0' * s['size']
+        return self.data[s['offset']:s['offset'] + s['size']]
+
+    def symbols(self):
+        # name -> (value, type, size), a global symbol wins over a local one
+        symbols = {}
+        for symtab in [s for s in self.sections if s['type'] == SHT_SYMTAB]:
+            strtab = self.sections[symtab['link']]
+            for offset in range(symtab['offset'], symtab['offset'] + symtab['size'], 16):
+                name, value, size, info, other, shndx = unpack_from('<IIIBBH', self.data, offset)
+                if name == 0 or shndx == 0 or (info & 0xf) not in (STT_NOTYPE, STT_OBJECT, STT_FUNC):
+                    continue
+                name = self._string(strtab, name)
+                if name.startswith('$'):
+                    continue                # ARM mapping symbol
+                if name in symbols and (info >> 4) == STB_LOCAL:
+                    continue
+                symbols[name] = (value, info & 0xf, size)
+        return symbols
+
+
+def lower_camel(name):
+    # Names in the RISC-V algorithm: Init -> init, LZ4ChunkSize -> lz4ChunkSize
+    n = 0
+    while n < len(name) and not name[n].islower():
+        n += 1
+    if n > 1 and n < len(name):
+        n -= 1
+    return name[:n].lower() + name[n:]
+
+
+def find_symbol(symbols, name, machine):
+    if name in symbols:
+        return symbols[name]
+    if machine == EM_RISCV:
+        return symbols.get(lower_camel(name))
+    return None
+
 
+def gen_flash_algo_files(elf, start=None):
+    # Returns the outputs, {kind: contents} with the kinds of OUTPUTS, and a summary
+    machine = MACHINES.get(elf.machine)
+    if machine is None:
+        raise ValueError('unknown ELF machine %u' % elf.machine)
+    algo_offset = machine['offset']
+
+    dev_dscr = elf.section('DevDscr')
+    dev_data = elf.contents(dev_dscr) if dev_dscr else None
+    target = machine['name']
+    if start is None:
+        start = machine['start']
+        if dev_data:
+            target, start = FlashInfo(data=dev_data).get_algo_start()
+
+    # Loaded image: every allocated section but DevDscr, by address, with
+    # ZI data zero filled. Code and data are linked from address 0.
+    image = sorted([s for s in elf.sections if (s['flags'] & SHF_ALLOC) and s['size'] and s['name'] != 'DevDscr'],
+                   key=lambda s: s['addr'])
+    base = image[0]['addr']
+    blob = bytearray(max([s['addr'] + s['size'] for s in image]) - base)
+    for s in image:
+        blob[s['addr'] - base:s['addr'] - base + s['size']] = elf.contents(s)
+    blob += b'\0' * (-len(blob) % 4)
+
+    # Static base (R9): the RW data, PrgData of Target.lin
+    data = elf.section('PrgData') or ([s for s in image if s['flags'] & SHF_WRITE] + [None])[0]
+    static_base = data['addr'] - base if data else len(blob)
+
+    symbols = elf.symbols()
+    def address(name):
+        sym = find_symbol(symbols, name, elf.machine)
+        return None if sym is None else start + algo_offset + sym[0] - base
+
+    lines = ["", "const uint32_t flash_algo_blob[] = {"]
+    if algo_offset:
+        lines.append("    " + "".join(["0x%08X, " % w for w in BLOB_HEADER]))
+    words = unpack('<%uI' % (len(blob) // 4), bytes(blob))
+    for i in range(0, len(words), 8):
+        lines.append("    " + "".join(["0x%08x, " % w for w in words[i:i + 8]]))
+    lines.append("};")
+    lines.append("")
+
+    # Descriptor for the hosts that load the blob themselves
+    dscr = {'target': target, 'machine': machine['name'], 'load_address': start,
+            'size': algo_offset + len(blob), 'entry_offsets': {}, 'data': {}, 'constants': {}}
+
+    # Static base (R9) and state blocks the host polls in algorithm RAM
+    if elf.machine == EM_ARM:
+        lines.append("#define FLASH_ALGO_STATIC_BASE  0x%08X" % (start + algo_offset + static_base))
+        dscr['static_base'] = start + algo_offset + static_base
+    for name in ALGO_DATA:
+        if address(name) is not None:
+            lines.append("#define FLASH_ALGO_%-16s 0x%08X" % (name.upper(), address(name)))
+            dscr['data'][name] = address(name)
+    for name in ALGO_CONSTANTS:
+        sym = find_symbol(symbols, name, elf.machine)
+        if sym:
+            value = unpack_from("<L", bytes(blob), sym[0] - base)[0]
+            lines.append("#define FLASH_ALGO_%-16s %u" % (name.upper(), value))
+            dscr['constants'][name] = value
+    # Stack and page buffers past the blob, from the linker script
+    for name in ALGO_RUNTIME:
+        if address(name) is not None:
+            lines.append("#define FLASH_ALGO_%-16s 0x%08X" % (name.upper(), address(name)))
+    if address('StackTop') is not None:
+        dscr['stack_top'] = address('StackTop')
+        dscr['page_buffers'] = [address(n) for n in ALGO_RUNTIME if n.startswith('PageBuffer') and address(n)]
+        dscr['end'] = address('AlgoEnd')
+
+    lines.append("")
+    lines.append("static const TARGET_FLASH flash = {")
+    for name in ALGO_FUNCTIONS:
+        if address(name) is not None:
+            lines.append("    0x%08X, // %s" % (address(name), name))
+            dscr['entry_offsets'][name] = address(name) - start
+        else:
+            lines.append("    0x00000000, // %s (not implemented)" % (name))
+    lines.append("")
+
+    summary = '%s start=0x%08x code+data=%u entry points=%u/%u' % (
+        target, start, len(blob), len(dscr['entry_offsets']), len(ALGO_FUNCTIONS))
+    files = {
+        'txt': ('// %s\n' % summary + "\n".join(lines)).encode(),
+        'blob': pack('<%uI' % (algo_offset // 4), *BLOB_HEADER[:algo_offset // 4]) + bytes(blob),
+        'json': (json.dumps(dscr, indent=4, sort_keys=True, separators=(',', ': ')) + '\n').encode(),
+    }
+    if dev_data:
+        files['DevDscr'] = dev_data
+    return files, summary
+
+
+def outputs(elf_path, single):
+    # {kind: path} of the outputs of an ELF file
+    base = splitext(ALGO_ELF_PATH if single else elf_path)[0]
+    paths = dict([(kind, base + '.' + kind) for kind in OUTPUTS])
+    paths['DevDscr'] = DEV_INFO_PATH if single else base + "_DevDscr"
+    return paths
+
+
+def gen_flash_algo(task):
+    elf_path, paths, start, cache_dir = task
+    with open(elf_path, "rb") as f:
+        data = f.read()
+
+    key = None
+    files = None
+    if cache_dir:
+        # the generator is part of the key, a change to it regenerates all
+        h = hashlib.sha1()
+        with open(__file__.replace('.pyc', '.py'), "rb") as f:
+            h.update(f.read())
+        h.update(data)
+        h.update(repr(start).encode())
+        key = join(cache_dir, h.hexdigest())
+
+    if key and exists(key + '.txt'):
+        files = {}
+        for kind in paths:
+            if exists(key + '.' + kind):
+                with open(key + '.' + kind, "rb") as f:
+                    files[kind] = f.read()
+        summary = files['txt'].decode().split('\n', 1)[0][3:]
+        cached = True
+    else:
+        try:
+            files, summary = gen_flash_algo_files(ElfFile(data), start)
+        except ValueError as e:
+            raise ValueError('%s: %s' % (elf_path, e))
+        cached = False
+
+    for kind in files:
+        with open(paths[kind], "wb") as f:
+            f.write(files[kind])
+        if key and not cached:
+            with open(key + '.' + kind, "wb") as f:
+                f.write(files[kind])
+    return '%s: %s -> %s%s' % (elf_path, summary, paths['txt'], ' (cached)' if cached else '')
+
+
+def main(default_elfs, single=False):
+    parser = OptionParser(usage='%prog [-j JOBS] [-s START] [-c CACHE] [--no-cache] [algo.axf ...]')
+    parser.add_option('-j', '--jobs', type='int', default=0, help='parallel jobs, default one per CPU')
+    parser.add_option('-s', '--start', help='ALGO_START, default from the FlashDevice name')
+    parser.add_option('-c', '--cache', default=CACHE_DIR, help='cache directory')
+    parser.add_option('--no-cache', dest='cache', action='store_const', const=None)
+    (options, args) = parser.parse_args()
+
+    # flash_algo.axf of the Keil project keeps its TMP_DIR outputs
+    single = single and not args
+    elfs = args or default_elfs
+    start = int(options.start, 0) if options.start else None
+    if options.cache and not exists(options.cache):
+        os.makedirs(options.cache)
+    tasks = [(e, outputs(e, single), start, options.cache) for e in elfs]
+
+    if len(tasks) > 1 and options.jobs != 1:
+        pool = Pool(options.jobs or None)
+        try:
+            results = pool.map(gen_flash_algo, tasks)
+        finally:
+            pool.close()
+            pool.join()
+    else:
+        results = [gen_flash_algo(t) for t in tasks]
+    for r in results:
+        print(r)
+
+
+if __name__ == '__main__':
+    main([ALGO_ELF_PATH], True)
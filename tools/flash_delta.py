@@ -0,0 +1,182 @@
+"""
+CMSIS-DAP Interface Firmware
+Copyright (c) 2009-2013 ARM Limited
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Host side of delta flashing. This script computes the ops for the
+ProgramDelta entry point of a flash algorithm from the image currently in
+flash and the new one. Only sectors that change get ops, the algorithm
+rebuilds them from copies of the current flash contents and literal data.
+
+Each op is a varint holding (length << 1 | type). A copy (type 0) is
+followed by a varint source offset from the device start, literal data
+(type 1) by length bytes. Copies read flash as it is when the sector is
+rebuilt, so sectors rewritten earlier already hold their new contents.
+Sectors larger than DeltaBufSize are rebuilt twice by the algorithm and
+must not copy from themselves.
+
+Usage:
+    flash_delta.py [-b BASE] [-u BUF] [-s SIZE] DevDscr current.bin new.bin out.dlta
+
+The output is the magic "DLTA" followed by one record per ProgramDelta call:
+<u32 address> <u32 ops size> <ops, padded to a multiple of 4 bytes>.
+"""
+from __future__ import print_function
+from optparse import OptionParser
+from struct import pack
+
+from flash_algo_gen import FlashInfo
+from flash_sector_crc import get_sectors
+
+DELTA_COPY = 0
+DELTA_DATA = 1
+
+MIN_COPY = 8                            # shorter runs are sent as data
+BLOCK = 16                              # match index granularity
+
+
+def varint(n):
+    s = bytearray()
+    while n >= 0x80:
+        s.append((n & 0x7F) | 0x80)
+        n >>= 7
+    s.append(n)
+    return s
+
+
+def op_copy(length, offset):
+    return varint(length << 1 | DELTA_COPY) + varint(offset)
+
+
+def op_data(data):
+    return varint(len(data) << 1 | DELTA_DATA) + data
+
+
+class FlashState(object):
+    # Host view of the flash contents, updated as sectors are rewritten
+    def __init__(self, flash_info, current):
+        self.base = flash_info.devAddr
+        self.data = bytearray(current) + bytearray([flash_info.valEmpty]) * (flash_info.szDev - len(current))
+        self.index = {}
+        self.add_index(0, len(self.data))
+
+    def add_index(self, start, end):
+        for p in range(start - start % 4, end - BLOCK + 1, 4):
+            self.index[bytes(self.data[p:p + BLOCK])] = p
+
+    def run(self, src, target, pos, limit):
+        # Length of the match of target[pos:] at flash offset src
+        n = 0
+        while pos + n < limit and src + n < len(self.data) and self.data[src + n] == target[pos + n]:
+            n += 1
+        return n
+
+
+def sector_ops(state, offset, target, self_ok):
+    # Ops rebuilding target at flash offset, greedy copies from the flash
+    ops = bytearray()
+    literal = bytearray()
+    end = offset + len(target)
+    pos = 0
+    while pos < len(target):
+        src, n = None, 0
+        if self_ok:
+            src, n = offset + pos, state.run(offset + pos, target, pos, len(target))
+        cand = state.index.get(bytes(target[pos:pos + BLOCK]))
+        if cand is not None and (self_ok or cand + BLOCK <= offset or cand >= end):
+            m = state.run(cand, target, pos, len(target))
+            if not self_ok:
+                m = min(m, offset - cand) if cand < offset else m
+            if m > n:
+                src, n = cand, m
+        if n < MIN_COPY:
+            literal.append(target[pos])
+            pos += 1
+            continue
+        if literal:
+            ops += op_data(literal)
+            literal = bytearray()
+        ops += op_copy(n, src)
+        pos += n
+    if literal:
+        ops += op_data(literal)
+    return ops
+
+
+def delta_image(flash_info, current, image, base, buf_size, max_size):
+    # (address, ops) records for ProgramDelta, each one a run of changed
+    # sectors that fits in max_size bytes of ops if possible
+    state = FlashState(flash_info, current)
+    records = []
+    adr, ops = None, bytearray()
+    for addr, size in get_sectors(flash_info):
+        if addr + size <= base or addr >= base + len(image):
+            continue
+        offset = addr - state.base
+        old = state.data[offset:offset + size]
+        target = bytearray(old)
+        start = max(base - addr, 0)
+        chunk = image[max(addr - base, 0):addr - base + size]
+        target[start:start + len(chunk)] = chunk
+        if target == old:
+            if ops:
+                records.append((adr, ops))
+            adr, ops = None, bytearray()
+            continue
+        s = sector_ops(state, offset, target, size <= buf_size)
+        if ops and len(ops) + len(s) > max_size:
+            records.append((adr, ops))
+            adr, ops = None, bytearray()
+        if adr is None:
+            adr = addr
+        ops += s
+        state.data[offset:offset + size] = target
+        state.add_index(offset, offset + size)
+    if ops:
+        records.append((adr, ops))
+    return records
+
+
+def write_container(path, records):
+    with open(path, "wb") as f:
+        f.write(b'DLTA')
+        for adr, ops in records:
+            f.write(pack('<LL', adr, len(ops)))
+            f.write(bytes(ops + bytearray(-len(ops) % 4)))
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="%prog [options] DevDscr current.bin new.bin out.dlta")
+    parser.add_option("-b", "--base", default=None,
+                      help="new image load address (default: device start address)")
+    parser.add_option("-u", "--buf", default="2048",
+                      help="DeltaBufSize of the algorithm, FLASH_ALGO_DELTABUFSIZE (default: 2048)")
+    parser.add_option("-s", "--size", default="4096",
+                      help="ops per call, a larger sector still gets a call of its own (default: 4096)")
+    (options, args) = parser.parse_args()
+    if len(args) != 4:
+        parser.error("DevDscr, current image, new image and output file are required")
+
+    flash_info = FlashInfo(args[0])
+    with open(args[1], "rb") as f:
+        current = f.read()
+    with open(args[2], "rb") as f:
+        image = f.read()
+    base = int(options.base, 0) if options.base is not None else flash_info.devAddr
+    records = delta_image(flash_info, current, image, base, int(options.buf, 0), int(options.size, 0))
+    write_container(args[3], records)
+    sent = sum([len(ops) for adr, ops in records])
+    print("%u bytes, %u calls, %u bytes of ops (%u%%)" % (len(image), len(records), sent,
+                                                         sent * 100 // max(len(image), 1)))
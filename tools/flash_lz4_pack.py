@@ -0,0 +1,147 @@
+"""
+CMSIS-DAP Interface Firmware
+Copyright (c) 2009-2013 ARM Limited
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Host side of compressed flashing. This script compresses an image for the
+ProgramPageLZ4 entry point of a flash algorithm, so that less data has to be
+written to the target RAM over SWD.
+
+The stream is made of LZ4 block sequences (token, literals, 16 bit offset,
+match length). A sequence with offset 0 has no match, so every chunk of
+LZ4ChunkSize decompressed bytes ends on a sequence boundary and the image can
+be split into ProgramPageLZ4 calls between any two chunks. Matches may reach
+back into chunks written by earlier calls, the algorithm reads them from flash.
+
+Usage:
+    flash_lz4_pack.py [-b BASE] [-c CHUNK] [-s SIZE] DevDscr image.bin out.lz4p
+
+The output is the magic "LZ4P" followed by one record per ProgramPageLZ4 call:
+<u32 address> <u32 compressed size> <data, padded to a multiple of 4 bytes>.
+"""
+from __future__ import print_function
+from optparse import OptionParser
+from struct import pack
+
+from flash_algo_gen import FlashInfo
+
+LZ4_MIN_MATCH = 4
+LZ4_MAX_OFFSET = 0xFFFF
+
+
+def lz4_length(n):
+    # Length bytes following the token for a 4 bit field that saturated
+    s = bytearray()
+    n -= 15
+    while n >= 255:
+        s.append(255)
+        n -= 255
+    s.append(n)
+    return s
+
+
+def lz4_sequence(literals, offset, match):
+    # One sequence, match is the full match length (0 for none)
+    token = min(len(literals), 15) << 4
+    if match:
+        token |= min(match - LZ4_MIN_MATCH, 15)
+    s = bytearray([token])
+    if len(literals) >= 15:
+        s += lz4_length(len(literals))
+    s += literals + pack('<H', offset)
+    if match and match - LZ4_MIN_MATCH >= 15:
+        s += lz4_length(match - LZ4_MIN_MATCH)
+    return s
+
+
+def compress_chunk(image, start, end, table):
+    # Greedy compression of image[start:end], matches may start anywhere in
+    # image[:pos] within the 64 KB window but must not run past the chunk
+    out = bytearray()
+    pos = lit = start
+    while pos + LZ4_MIN_MATCH <= end:
+        key = image[pos:pos + LZ4_MIN_MATCH]
+        cand = table.get(key)
+        table[key] = pos
+        if cand is None or pos - cand > LZ4_MAX_OFFSET:
+            pos += 1
+            continue
+        n = LZ4_MIN_MATCH
+        while pos + n < end and image[cand + n] == image[pos + n]:
+            n += 1
+        out += lz4_sequence(image[lit:pos], pos - cand, n)
+        for p in range(pos + 1, min(pos + n, len(image) - LZ4_MIN_MATCH + 1)):
+            table[image[p:p + LZ4_MIN_MATCH]] = p
+        pos = lit = pos + n
+    for p in range(pos, min(end, len(image) - LZ4_MIN_MATCH + 1)):
+        table[image[p:p + LZ4_MIN_MATCH]] = p
+    if lit < end:
+        out += lz4_sequence(image[lit:end], 0, 0)
+    return out
+
+
+def compress_image(image, base, chunk, max_size):
+    # (address, data) records for ProgramPageLZ4, each one as many whole
+    # chunks as fit in max_size bytes of compressed data
+    if base % chunk:
+        raise ValueError("image base 0x%08X is not a multiple of the chunk size" % base)
+    records = []
+    table = {}
+    adr = base
+    data = bytearray()
+    for start in range(0, len(image), chunk):
+        c = compress_chunk(image, start, min(start + chunk, len(image)), table)
+        if len(c) > max_size:
+            raise ValueError("chunk at 0x%08X does not fit in %u bytes" % (base + start, max_size))
+        if len(data) + len(c) > max_size:
+            records.append((adr, data))
+            adr = base + start
+            data = bytearray()
+        data += c
+    if data:
+        records.append((adr, data))
+    return records
+
+
+def write_container(path, records):
+    with open(path, "wb") as f:
+        f.write(b'LZ4P')
+        for adr, data in records:
+            f.write(pack('<LL', adr, len(data)))
+            f.write(bytes(data + bytearray(-len(data) % 4)))
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="%prog [options] DevDscr image.bin out.lz4p")
+    parser.add_option("-b", "--base", default=None,
+                      help="image load address (default: device start address)")
+    parser.add_option("-c", "--chunk", default="256",
+                      help="LZ4ChunkSize of the algorithm, FLASH_ALGO_LZ4CHUNKSIZE (default: 256)")
+    parser.add_option("-s", "--size", default=None,
+                      help="largest compressed call (default: programming page size)")
+    (options, args) = parser.parse_args()
+    if len(args) != 3:
+        parser.error("DevDscr, image and output file are required")
+
+    flash_info = FlashInfo(args[0])
+    with open(args[1], "rb") as f:
+        image = f.read()
+    base = int(options.base, 0) if options.base is not None else flash_info.devAddr
+    size = int(options.size, 0) if options.size is not None else flash_info.szPage
+    records = compress_image(image, base, int(options.chunk, 0), size)
+    write_container(args[2], records)
+    packed = sum([len(data) for adr, data in records])
+    print("%u bytes in %u calls, %u bytes (%u%%)" % (len(image), len(records), packed,
+                                                    packed * 100 // max(len(image), 1)))
@@ -0,0 +1,116 @@
+"""
+CMSIS-DAP Interface Firmware
+Copyright (c) 2009-2013 ARM Limited
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Host side of differential flashing. This script splits an image along the
+sector table of a flash algorithm (DevDscr extracted by flash_algo_gen.py) and
+computes the CRC-32 of every sector the image touches. The values match the
+ones returned by the ComputeCRC entry point of the algorithm, so a host only
+needs to erase and program the sectors whose CRCs differ.
+
+Usage:
+    flash_sector_crc.py [-b BASE] [-t TARGET_CRCS] DevDscr image.bin
+
+TARGET_CRCS is a text file with one "<sector address> <crc>" pair per line, as
+read back from the target with ComputeCRC. Without it the image CRCs are
+printed in the same format.
+"""
+from __future__ import print_function
+from optparse import OptionParser
+from zlib import crc32
+
+from flash_algo_gen import FlashInfo
+
+
+def get_sectors(flash_info):
+    # Expand the FlashDevice sector table into (address, size) tuples.
+    # Sector addresses are usually offsets from the device start address,
+    # but some FlashDev.c files use absolute addresses.
+    sectors = []
+    dev_end = flash_info.devAddr + flash_info.szDev
+    starts = []
+    for addr in flash_info.sectAddr:
+        if addr < flash_info.devAddr:
+            addr += flash_info.devAddr
+        starts.append(addr)
+    for i in range(len(starts)):
+        addr = starts[i]
+        end = starts[i + 1] if i + 1 < len(starts) else dev_end
+        while addr < end:
+            sectors.append((addr, flash_info.sectSize[i]))
+            addr += flash_info.sectSize[i]
+    return sectors
+
+
+def image_sector_crcs(flash_info, image, base=None):
+    # CRC-32 of each sector covered by the image. Sector bytes outside of the
+    # image are taken as erased, since that is what an erase leaves behind.
+    if base is None:
+        base = flash_info.devAddr
+    empty = bytearray([flash_info.valEmpty])
+    crcs = []
+    for addr, size in get_sectors(flash_info):
+        if addr + size <= base or addr >= base + len(image):
+            continue
+        start = addr - base
+        data = bytearray(image[max(start, 0):start + size])
+        if start < 0:
+            data = empty * (-start) + data
+        data += empty * (size - len(data))
+        crcs.append((addr, size, crc32(bytes(data)) & 0xFFFFFFFF))
+    return crcs
+
+
+def changed_sectors(image_crcs, target_crcs):
+    # Sectors of the image whose CRC differs from the one read from the target
+    return [(addr, size) for addr, size, crc in image_crcs
+            if target_crcs.get(addr) != crc]
+
+
+def read_target_crcs(path):
+    target_crcs = {}
+    with open(path, "r") as f:
+        for line in f:
+            t = line.split()
+            if len(t) < 2: continue
+            target_crcs[int(t[0], 16)] = int(t[1], 16)
+    return target_crcs
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage="%prog [options] DevDscr image.bin")
+    parser.add_option("-b", "--base", default=None,
+                      help="image load address (default: device start address)")
+    parser.add_option("-t", "--target", default=None, metavar="TARGET_CRCS",
+                      help="sector CRCs read from the target with ComputeCRC")
+    (options, args) = parser.parse_args()
+    if len(args) != 2:
+        parser.error("DevDscr and image file are required")
+
+    flash_info = FlashInfo(args[0])
+    with open(args[1], "rb") as f:
+        image = f.read()
+    base = int(options.base, 0) if options.base is not None else None
+    crcs = image_sector_crcs(flash_info, image, base)
+
+    if options.target is None:
+        for addr, size, crc in crcs:
+            print("0x%08X 0x%08X" % (addr, crc))
+    else:
+        changed = changed_sectors(crcs, read_target_crcs(options.target))
+        for addr, size in changed:
+            print("0x%08X 0x%08X" % (addr, size))
+        print("%d of %d sectors need erase and program" % (len(changed), len(crcs)))
@@ -0,0 +1,56 @@
+#
+# Compare the total lines of a bench run with bench.baseline
+#
+#   awk -v tol=<percent> -f bench.awk bench.baseline <run>
+#
+# Prints every target with its calls/KB, accesses/KB and cycles/KB against
+# the baseline and exits with 1 when one of them grew by more than tol
+# percent, or when a target of the baseline did not run.
+#
+
+function field(name,    i) {
+  for (i = 1; i <= NF; i++) {
+    if (index($i, name "=") == 1) return substr($i, length(name) + 2) + 0;
+  }
+  return -1;
+}
+
+$2 != "total" { next }
+
+FNR == NR {
+  base[$1, "calls/KB"]    = field("calls/KB");
+  base[$1, "accesses/KB"] = field("accesses/KB");
+  base[$1, "cycles/KB"]   = field("cycles/KB");
+  targets[$1] = 1;
+  next;
+}
+
+{
+  seen[$1] = 1;
+  if (!($1 in targets)) {
+    printf("%-12s not in the baseline\n", $1);
+    next;
+  }
+  n = split("calls/KB accesses/KB cycles/KB", names, " ");
+  line = sprintf("%-12s", $1);
+  for (i = 1; i <= n; i++) {
+    was = base[$1, names[i]];
+    now = field(names[i]);
+    line = line sprintf(" %s=%s/%s", names[i], now, was);
+    if (now > was * (1 + tol / 100.0)) {
+      line = line " WORSE";
+      failed = 1;
+    }
+  }
+  print line;
+}
+
+END {
+  for (t in targets) {
+    if (!(t in seen)) {
+      printf("%-12s did not run\n", t);
+      failed = 1;
+    }
+  }
+  exit failed;
+}
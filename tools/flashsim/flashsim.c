@@ -0,0 +1,902 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Flash algorithm throughput benchmark
+ *
+ *  Usage: flashsim_<target> [-s size] [-i image.bin]
+ *                           [-e sector|range|chip|sectorstart|chipstart]
+ *                           [-p parallelism] [-z image.lz4p]
+ *                           [-o current.bin -d image.dlta] [-o current.bin -u] [-b] [-a] [-c]
+ *
+ *  Erases, programs and verifies an image the way a debugger drives a
+ *  flash algorithm and prints, per phase, the entry point calls, register
+ *  accesses, flash stores and simulated cycles. Runs on x86-64 Linux only,
+ *  accesses are trapped with page protection and the trap flag.
+ *
+ *  With -z the image is programmed with ProgramPageLZ4 from a container
+ *  written by tools/flash_lz4_pack.py, -i gives the uncompressed image.
+ *  With -d the flash starts out holding the -o image and is updated with
+ *  ProgramDelta from the ops written by tools/flash_delta.py, without an
+ *  erase phase. With -u the pages are written with ProgramPageUpdate over
+ *  the -o image, also without an erase phase. With -b ProgramPageDual gets
+ *  the pages of the two halves of the image in turn, so that with a size
+ *  of two banks each page is written while the other bank is verified.
+ *  With -e sectorstart or chipstart the erase runs in the background and
+ *  the host polls EraseProgress every millisecond with the core halted.
+ *  With -a every phase is a single RunAgent call (algorithms built with
+ *  AGENT=1), a second thread plays the host and fills the AgentQueue.
+ *
+ *  The register accesses, flash stores and busy time leave out the work
+ *  of the CPU in between. With -c every host instruction of an entry point
+ *  is single stepped as well and counts INSN_CYCLES, a proxy for the loops
+ *  of the algorithm: x86 code of the host compiler, not Thumb, but it
+ *  moves with them. It is slow, and not for -a, where the agent spins.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "flashsim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define PAGE_SIZE       4096
+#define PAGE_MASK       (~(u32)(PAGE_SIZE - 1))
+#define MAX_PAGES       16
+
+#define ACCESS_CYCLES   2                /* register access over the bus */
+
+#define SCS_PAGE        0xE000E000       /* SysTick, for every Cortex-M model */
+#define SYST_CSR        0xE000E010
+#define SYST_RVR        0xE000E014
+#define SYST_CVR        0xE000E018
+#define SYST_ENABLE     0x00000001
+#define SYST_MAX        0x00FFFFFF
+#define STORE_CYCLES    1                /* store into the flash array */
+#define INSN_CYCLES     1                /* host instruction of the algorithm, -c */
+
+#define EFLAGS_TF       0x100
+#define PF_WRITE        0x2
+
+// Flash algorithm, compiled with long as 32-bit int
+extern int Init        (u32 adr, u32 clk, u32 fnc);
+extern int UnInit      (u32 fnc);
+extern int EraseChip   (void);
+extern int EraseSector (u32 adr);
+extern int ProgramPage (u32 adr, u32 sz, u8 *buf);
+extern u32 Verify      (u32 adr, u32 sz, u8 *buf) __attribute__((weak));
+extern int BlankCheck  (u32 adr, u32 sz, u8 pat) __attribute__((weak));
+extern u32 ComputeCRC  (u32 adr, u32 sz) __attribute__((weak));
+extern int EraseRange  (u32 start, u32 size) __attribute__((weak));
+extern int SetParallelism (u32 psize) __attribute__((weak));
+extern int ProgramPageLZ4 (u32 adr, u32 sz, u8 *buf) __attribute__((weak));
+extern int ProgramDelta (u32 adr, u32 sz, u8 *buf) __attribute__((weak));
+extern int ProgramPageUpdate (u32 adr, u32 sz, u8 *buf) __attribute__((weak));
+extern int ProgramPageDual (u32 adr, u32 sz, u8 *buf) __attribute__((weak));
+extern int EraseSectorStart (u32 adr) __attribute__((weak));
+extern int EraseChipStart (void) __attribute__((weak));
+extern int EraseProgress (void) __attribute__((weak));
+extern int RunAgent (void) __attribute__((weak));
+extern volatile u32 SkippedUnits __attribute__((weak));
+extern volatile struct { u32 programmed, verified, failed; } BankProgress[2] __attribute__((weak));
+extern volatile struct {                 /* struct FlashStats, built with STATS=1 */
+  u32 version, busyPolls, busyCycles, written, skipped;
+  struct { u32 calls, cycles; } entry[16];
+} FlashStats __attribute__((weak));
+
+extern volatile struct {                 /* struct AgentQueue, built with AGENT=1 */
+  u32 state, head, tail, errors;
+  struct { u32 cmd, adr, sz, buf, result; } slot[8];
+} AgentQueue __attribute__((weak));
+
+#define AGENT_SLOTS        8             /* AGENT_ in FlashOS.h */
+#define AGENT_STOP         0
+#define AGENT_ERASESECTOR  1
+#define AGENT_ERASECHIP    2
+#define AGENT_ERASERANGE   3
+#define AGENT_PROGRAM      4
+#define AGENT_VERIFY       5
+#define AGENT_BLANKCHECK   6
+#define AGENT_CRC          7
+
+static const char *const statsNames[] = {  /* STATS_ indices in FlashOS.h */
+  "Init", "UnInit", "EraseChip", "EraseSector", "ProgramPage", "Verify",
+  "BlankCheck", "ComputeCRC", "ProgramPageStart", "EraseRange",
+  "ProgramPageLZ4", "ProgramDelta", "ProgramPageUpdate", "ProgramPageDual",
+  "EraseSectorStart", "EraseChipStart"
+};
+
+#define ERASE_BUSY      1                /* EraseProgress, ERASE_ in FlashOS.h */
+#define ERASE_DONE      2
+#define HOST_POLL_NS    1000000          /* host work between EraseProgress calls */
+
+struct sim_stats sim_stats;
+u32 sim_hz;
+
+static u32 flashBase;                    /* host address of the flash array */
+static u32 flashSize;
+static u8 *flashMem;
+
+static struct {
+  u32 page;
+  u32 *regs;
+} regPages[MAX_PAGES];
+static int numPages;
+
+static u64 now;                          /* simulated time in ns */
+static u64 coreCycles;                   /* all cycles, for SysTick */
+static u64 sysTickBase;                  /* coreCycles when CVR was cleared */
+static u64 busyUntil;
+static int busyPolled;
+static u64 idleTime;                     /* core halted, host busy elsewhere */
+
+static struct {                          /* access being single stepped */
+  int pending;
+  int flash;
+  int write;
+  u32 addr;
+  u32 len;
+  u8 old[16];
+} step;
+static int tracing;                      /* -c, entry points are single stepped */
+
+
+/*
+ *  Services for the models
+ */
+
+void sim_fail (const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", model.name);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  _exit(3);
+}
+
+u32 *sim_reg (u32 addr) {
+  int i;
+
+  for (i = 0; i < numPages; i++) {
+    if (regPages[i].page == (addr & PAGE_MASK)) {
+      return &regPages[i].regs[(addr & ~PAGE_MASK) >> 2];
+    }
+  }
+  sim_fail("no register page at 0x%08X", addr);
+  return 0;
+}
+
+u32 sim_target (u32 addr) {
+  return addr - flashBase + FlashDevice.addr;
+}
+
+u32 sim_host (u32 addr) {
+  return addr - FlashDevice.addr + flashBase;
+}
+
+int sim_in_flash (u32 addr, u32 len) {
+  return (addr >= FlashDevice.addr) && (len <= flashSize) &&
+         ((addr - FlashDevice.addr) <= (flashSize - len));
+}
+
+int sim_sector_nr (u32 n, u32 *start, u32 *size) {
+  const struct sim_sector *s = FlashDevice.sectors;
+  u32 adr, end;
+
+  for (; s->size != 0xFFFFFFFF; s++) {
+    adr = s->addr;
+    if (adr < FlashDevice.addr) adr += FlashDevice.addr;
+    end = (s[1].size != 0xFFFFFFFF) ? s[1].addr : (FlashDevice.addr + FlashDevice.size);
+    if ((s[1].size != 0xFFFFFFFF) && (end < FlashDevice.addr)) end += FlashDevice.addr;
+    for (; adr < end; adr += s->size) {
+      if (n-- == 0) {
+        *start = adr;
+        *size = s->size;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int sim_sector (u32 addr, u32 *start, u32 *size) {
+  u32 n;
+
+  for (n = 0; sim_sector_nr(n, start, size); n++) {
+    if ((addr >= *start) && ((addr - *start) < *size)) return 1;
+  }
+  return 0;
+}
+
+int sim_erased (u32 addr, u32 len) {
+  const u8 *p = flashMem + (addr - FlashDevice.addr);
+
+  while (len--) {
+    if (*p++ != FlashDevice.empty) return 0;
+  }
+  return 1;
+}
+
+void sim_erase (u32 addr, u32 len) {
+  if (!sim_in_flash(addr, len)) sim_fail("erase outside of flash 0x%08X", addr);
+  mprotect(flashMem, flashSize, PROT_READ | PROT_WRITE);
+  memset(flashMem + (addr - FlashDevice.addr), FlashDevice.empty, len);
+  mprotect(flashMem, flashSize, PROT_READ);
+}
+
+void sim_program (u32 addr, const u8 *data, u32 len) {
+  u8 *p;
+
+  if (!sim_in_flash(addr, len)) sim_fail("program outside of flash 0x%08X", addr);
+  p = flashMem + (addr - FlashDevice.addr);
+  mprotect(flashMem, flashSize, PROT_READ | PROT_WRITE);
+  while (len--) {
+    *p++ &= *data++;                     // cells only go from 1 to 0
+  }
+  mprotect(flashMem, flashSize, PROT_READ);
+}
+
+/*
+ *  Time runs in ns, cycles are counted at the core clock of the moment
+ */
+void sim_cycles (u64 cycles) {
+  now += cycles * 1000000000ULL / sim_hz;
+  coreCycles += cycles;
+  sim_stats.cycles += cycles;
+}
+
+static void runUntil (u64 t) {
+  u64 cycles = (t - now) * sim_hz / 1000000000ULL;
+
+  now = t;
+  coreCycles += cycles;
+  sim_stats.cycles += cycles;
+  sim_stats.busy += cycles;
+}
+
+u64 sim_us (u32 us) {
+  return (u64)us * 1000;
+}
+
+void sim_start (u64 ns) {
+  busyUntil = now + ns;
+  busyPolled = 0;
+  sim_stats.ops++;
+}
+
+/*
+ *  The first poll of an operation reports busy, so that wait loops run
+ *  at least once. The next one skips the clock to the end of the
+ *  operation instead of trapping every iteration of the loop.
+ */
+int sim_busy (void) {
+  if (now >= busyUntil) return 0;
+  if (!busyPolled) {
+    busyPolled = 1;
+    return 1;
+  }
+  runUntil(busyUntil);
+  return 0;
+}
+
+void sim_stall (void) {
+  if (now < busyUntil) runUntil(busyUntil);
+}
+
+/*
+ *  The core is halted while the host does other work, an operation that
+ *  is still running reports busy again on the next poll
+ */
+static void hostIdle (u64 ns) {
+  now += ns;
+  idleTime += ns;
+  busyPolled = 0;
+}
+
+u32 sim_crc_word (u32 crc, u32 data, u32 poly) {
+  int k;
+
+  crc ^= data;                           // MSB first, as the CRC unit does
+  for (k = 0; k < 32; k++) {
+    crc = (crc & 0x80000000) ? (crc << 1) ^ poly : (crc << 1);
+  }
+  return crc;
+}
+
+u32 sim_reverse (u32 v) {
+  u32 r = 0;
+  int k;
+
+  for (k = 0; k < 32; k++, v >>= 1) {
+    r = (r << 1) | (v & 1);
+  }
+  return r;
+}
+
+
+/*
+ *  Store width of the x86-64 instruction at ip, 0 if not known
+ */
+static u32 storeWidth (const u8 *ip) {
+  u32 w = 4;
+
+  for (;; ip++) {
+    if (*ip == 0x66) w = 2;
+    else if ((*ip != 0xF0) && (*ip != 0xF2) && (*ip != 0xF3) &&
+             (*ip != 0x2E) && (*ip != 0x3E) && (*ip != 0x26) &&
+             (*ip != 0x36) && (*ip != 0x64) && (*ip != 0x65) && (*ip != 0x67)) break;
+  }
+  if ((*ip & 0xF0) == 0x40) {            // REX
+    if (*ip & 0x08) w = 8;
+    ip++;
+  }
+  switch (*ip) {
+    case 0x00: case 0x08: case 0x20: case 0x28: case 0x30: case 0x80:
+    case 0x86: case 0x88: case 0xAA: case 0xC0: case 0xC6: case 0xD0:
+    case 0xD2: case 0xF6: case 0xFE:
+      return 1;
+    case 0x01: case 0x09: case 0x21: case 0x29: case 0x31: case 0x81:
+    case 0x83: case 0x87: case 0x89: case 0xAB: case 0xC1: case 0xC7:
+    case 0xD1: case 0xD3: case 0xF7: case 0xFF:
+      return w;
+    case 0x0F:
+      if ((ip[1] == 0x11) || (ip[1] == 0x29) || (ip[1] == 0x7F) || (ip[1] == 0xE7)) return 16;
+      if (ip[1] == 0xD6) return 8;
+      break;
+  }
+  return 0;
+}
+
+/*
+ *  SysTick counts down the core cycles from RVR, CVR reads as 0 when it
+ *  was cleared and the counter is stopped
+ */
+static u32 sysTickRead (u32 addr) {
+  u32 load = *sim_reg(SYST_RVR) & SYST_MAX;
+
+  if ((addr != SYST_CVR) || !(*sim_reg(SYST_CSR) & SYST_ENABLE)) return *sim_reg(addr);
+  return load - (u32)((coreCycles - sysTickBase) % ((u64)load + 1));
+}
+
+static void sysTickWrite (u32 addr, u32 val) {
+  int enabled = (*sim_reg(SYST_CSR) & SYST_ENABLE) != 0;
+
+  if ((addr == SYST_CSR) && enabled && !(val & SYST_ENABLE)) {
+    *sim_reg(SYST_CVR) = sysTickRead(SYST_CVR);      /* holds its value when stopped */
+  }
+  if ((addr == SYST_CVR) || ((addr == SYST_CSR) && (val & SYST_ENABLE) && !enabled)) {
+    sysTickBase = coreCycles;
+  }
+  *sim_reg(addr) = (addr == SYST_CVR) ? 0 : val;
+}
+
+static u32 regRead (u32 addr) {
+  return ((addr & PAGE_MASK) == SCS_PAGE) ? sysTickRead(addr) : model.read(addr);
+}
+
+static void regWrite (u32 addr, u32 val) {
+  if ((addr & PAGE_MASK) == SCS_PAGE) sysTickWrite(addr, val);
+  else model.write(addr, val);
+}
+
+static void onFault (int sig, siginfo_t *si, void *ctx) {
+  ucontext_t *uc = (ucontext_t *)ctx;
+  unsigned long a = (unsigned long)si->si_addr;
+  u32 addr = (u32)a;
+  u32 word = addr & ~3U;
+  u32 *p;
+
+  if (step.pending || (a >> 32)) {
+    sim_fail("access to 0x%lX at ip 0x%llX", a, (u64)uc->uc_mcontext.gregs[REG_RIP]);
+  }
+  step.write = (uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+  step.addr = addr;
+
+  if ((addr >= flashBase) && ((addr - flashBase) < flashSize)) {
+    if (!step.write) sim_fail("load from flash 0x%08X faulted", addr);
+    step.flash = 1;
+    step.len = storeWidth((const u8 *)uc->uc_mcontext.gregs[REG_RIP]);
+    if (step.len == 0) step.len = 4;
+    if (step.len > flashSize - (addr - flashBase)) step.len = flashSize - (addr - flashBase);
+    memcpy(step.old, (const void *)a, step.len);
+    mprotect(flashMem, flashSize, PROT_READ | PROT_WRITE);
+  } else {
+    step.flash = 0;
+    p = sim_reg(addr);
+    mprotect((void *)(unsigned long)(addr & PAGE_MASK), PAGE_SIZE, PROT_READ | PROT_WRITE);
+    if (step.write) {
+      *(volatile u32 *)(unsigned long)word = *p;   // old value for partial stores
+    } else {
+      sim_cycles(ACCESS_CYCLES);
+      sim_stats.reads++;
+      *(volatile u32 *)(unsigned long)word = regRead(word);
+    }
+  }
+  step.pending = 1;
+  uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void onStep (int sig, siginfo_t *si, void *ctx) {
+  ucontext_t *uc = (ucontext_t *)ctx;
+  u8 data[16];
+  u32 word = step.addr & ~3U;
+  u32 val;
+
+  if (tracing) {
+    sim_cycles(INSN_CYCLES);
+    sim_stats.insns++;
+    if (!step.pending) return;
+  } else {
+    if (!step.pending) sim_fail("unexpected trap at ip 0x%llX", (u64)uc->uc_mcontext.gregs[REG_RIP]);
+    uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+  }
+  step.pending = 0;
+
+  if (step.flash) {
+    memcpy(data, (const void *)(unsigned long)step.addr, step.len);
+    memcpy((void *)(unsigned long)step.addr, step.old, step.len);
+    mprotect(flashMem, flashSize, PROT_READ);
+    sim_cycles(STORE_CYCLES);
+    sim_stats.stores++;
+    model.store(sim_target(step.addr), data, step.len);
+  } else {
+    val = *(volatile u32 *)(unsigned long)word;
+    mprotect((void *)(unsigned long)(step.addr & PAGE_MASK), PAGE_SIZE, PROT_NONE);
+    if (step.write) {
+      sim_cycles(ACCESS_CYCLES);
+      sim_stats.writes++;
+      regWrite(word, val);
+    }
+  }
+}
+
+
+/*
+ *  Memory map of the target
+ */
+static void *mapFixed (u32 addr, u32 size, int prot) {
+  void *p;
+
+  p = mmap((void *)(unsigned long)addr, size, prot,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if ((p == MAP_FAILED) || (p != (void *)(unsigned long)addr)) {
+    fprintf(stderr, "%s: cannot map 0x%08X\n", model.name, addr);
+    exit(2);
+  }
+  return p;
+}
+
+static void mapPage (u32 page) {
+  if (numPages == MAX_PAGES) sim_fail("too many register pages");
+  mapFixed(page, PAGE_SIZE, PROT_NONE);
+  regPages[numPages].page = page;
+  regPages[numPages].regs = calloc(PAGE_SIZE / 4, 4);
+  numPages++;
+}
+
+static void mapTarget (void) {
+  struct sigaction sa;
+  const u32 *pg;
+
+  flashBase = model.alias ? model.alias : FlashDevice.addr;
+  flashSize = (FlashDevice.size + PAGE_SIZE - 1) & PAGE_MASK;
+  flashMem = mapFixed(flashBase, flashSize, PROT_READ | PROT_WRITE);
+  memset(flashMem, FlashDevice.empty, flashSize);
+  mprotect(flashMem, flashSize, PROT_READ);
+
+  for (pg = model.pages; *pg; pg++) {
+    mapPage(*pg);
+  }
+  mapPage(SCS_PAGE);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = onFault;
+  sigaction(SIGSEGV, &sa, 0);
+  sa.sa_sigaction = onStep;
+  sigaction(SIGTRAP, &sa, 0);
+}
+
+
+/*
+ *  Benchmark
+ */
+static const char *phaseName;
+static u64 phaseStart;
+static u64 totalTime;
+static struct sim_stats total;
+
+static void beginPhase (const char *name) {
+  memset(&sim_stats, 0, sizeof(sim_stats));
+  phaseName = name;
+  phaseStart = now;
+  idleTime = 0;
+}
+
+/*
+ *  FlashStats as counted on the target, cleared by Init in each phase
+ */
+static void printStats (void) {
+  unsigned i;
+
+  printf("%-12s %-8s target busyPolls=%u busyCycles=%u written=%u skipped=%u\n",
+         model.name, phaseName, FlashStats.busyPolls, FlashStats.busyCycles,
+         FlashStats.written, FlashStats.skipped);
+  for (i = 0; i < sizeof(statsNames) / sizeof(statsNames[0]); i++) {
+    if (FlashStats.entry[i].calls) {
+      printf("%-12s %-8s target %-17s calls=%u cycles=%u\n", model.name, phaseName,
+             statsNames[i], FlashStats.entry[i].calls, FlashStats.entry[i].cycles);
+    }
+  }
+}
+
+static void endPhase (void) {
+  printf("%-12s %-8s calls=%llu reads=%llu writes=%llu stores=%llu ops=%llu"
+         " busy=%llu cycles=%llu ms=%.3f\n",
+         model.name, phaseName, sim_stats.calls, sim_stats.reads,
+         sim_stats.writes, sim_stats.stores, sim_stats.ops, sim_stats.busy,
+         sim_stats.cycles, (double)(now - phaseStart) / 1000000.0);
+  if (tracing) printf("%-12s %-8s insns=%llu\n", model.name, phaseName, sim_stats.insns);
+  if (idleTime) printf("%-12s %-8s host ms=%.3f while the core was halted\n", model.name, phaseName, (double)idleTime / 1000000.0);
+  if (&SkippedUnits && SkippedUnits) printf("%-12s %-8s skipped=%u erased write units\n", model.name, phaseName, SkippedUnits);
+  if (&FlashStats) printStats();
+  totalTime    += now - phaseStart;
+  total.cycles += sim_stats.cycles;
+  total.busy   += sim_stats.busy;
+  total.reads  += sim_stats.reads;
+  total.writes += sim_stats.writes;
+  total.stores += sim_stats.stores;
+  total.ops    += sim_stats.ops;
+  total.calls  += sim_stats.calls;
+  total.insns  += sim_stats.insns;
+}
+
+static int check (const char *what, int failed) {
+  if (failed) {
+    fprintf(stderr, "%s: %s failed\n", model.name, what);
+    exit(1);
+  }
+  return 0;
+}
+
+/*
+ *  Set and clear the trap flag around an entry point, with -c
+ */
+static inline void traceBegin (void) {
+  if (tracing) __asm__ volatile ("pushfq; orq %0, (%%rsp); popfq" : : "i" (EFLAGS_TF) : "cc", "memory");
+}
+
+static inline void traceEnd (void) {
+  if (tracing) __asm__ volatile ("pushfq; andq %0, (%%rsp); popfq" : : "i" (~EFLAGS_TF) : "cc", "memory");
+}
+
+#define CALL(f)  ({ __typeof__(f) r_; sim_stats.calls++; traceBegin(); r_ = (f); traceEnd(); r_; })
+
+/*
+ *  Background erase: poll EraseProgress, the host works in between
+ */
+static void eraseWait (void) {
+  int state;
+
+  while ((state = CALL(EraseProgress())) == ERASE_BUSY) {
+    hostIdle(HOST_POLL_NS);
+  }
+  check("EraseProgress", state != ERASE_DONE);
+}
+
+static u32 crc32 (const u8 *p, u32 n) {
+  u32 crc = 0xFFFFFFFF;
+  int k;
+
+  while (n--) {
+    crc ^= *p++;
+    for (k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+/*
+ *  Resident agent: RunAgent runs on its own thread, where the accesses
+ *  trap as before, while this one writes commands into the queue
+ */
+static pthread_t agentThread;
+static int agentResult;
+
+static void *agentMain (void *arg) {
+  agentResult = RunAgent();
+  return 0;
+}
+
+static void agentStart (void) {
+  AgentQueue.head = AgentQueue.tail = 0;
+  sim_stats.calls++;
+  if (pthread_create(&agentThread, 0, agentMain, 0)) sim_fail("no agent thread");
+}
+
+/*
+ *  Queue a command once a slot is free
+ *    Return Value:   slot of the command
+ */
+static u32 agentCommand (u32 cmd, u32 adr, u32 sz, u32 buf) {
+  u32 head = AgentQueue.head;
+  u32 n = head & (AGENT_SLOTS - 1);
+
+  while (head - AgentQueue.tail >= AGENT_SLOTS) sched_yield();
+  AgentQueue.slot[n].cmd = cmd;
+  AgentQueue.slot[n].adr = adr;
+  AgentQueue.slot[n].sz  = sz;
+  AgentQueue.slot[n].buf = buf;
+  __sync_synchronize();                  // slot before head
+  AgentQueue.head = head + 1;
+  return n;
+}
+
+static void agentStop (void) {
+  agentCommand(AGENT_STOP, 0, 0, 0);
+  pthread_join(agentThread, 0);
+  check("RunAgent", agentResult);
+}
+
+/*
+ *  Compressed image ("LZ4P") or delta ("DLTA"), then <address> <size>
+ *  <data padded to words> for each ProgramPageLZ4 or ProgramDelta call
+ */
+static u8 *loadPacked (const char *path, const char *magic, u32 *len) {
+  u8 *p;
+  FILE *f;
+
+  if ((f = fopen(path, "rb")) == 0) sim_fail("cannot open %s", path);
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  p = mmap(0, *len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (p == MAP_FAILED) sim_fail("no buffer");
+  if ((fread(p, 1, *len, f) != *len) || (*len < 4) || memcmp(p, magic, 4)) {
+    sim_fail("%s is not a %s file", path, magic);
+  }
+  fclose(f);
+  return p;
+}
+
+static void makeImage (u8 *p, u32 n) {
+  u32 x = 0x2545F491, i;
+
+  for (i = 0; i < n; i++) {              // code like data with erased gaps
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    p[i] = ((i & 0x3FFF) >= 0x3800) ? FlashDevice.empty : (u8)x;
+  }
+}
+
+int main (int argc, char **argv) {
+  const char *image = 0, *erase = "sector", *packed = 0, *delta = 0, *current = 0;
+  u32 size = 0, psize = 0, adr, start, sz, n, kb, pages, zlen = 0;
+  u8 *buf, *zbuf = 0, *old;
+  FILE *f;
+  int c, update = 0, dual = 0, agent = 0;
+
+  while ((c = getopt(argc, argv, "s:i:e:p:z:d:o:ubac")) != -1) {
+    switch (c) {
+      case 's': size = strtoul(optarg, 0, 0); break;
+      case 'i': image = optarg; break;
+      case 'e': erase = optarg; break;
+      case 'p': psize = strtoul(optarg, 0, 0); break;
+      case 'z': packed = optarg; break;
+      case 'd': delta = optarg; break;
+      case 'o': current = optarg; break;
+      case 'u': update = 1; break;
+      case 'b': dual = 1; break;
+      case 'a': agent = 1; break;
+      case 'c': tracing = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-s size] [-i image.bin] [-e sector|range|chip|sectorstart|chipstart] [-p parallelism]"
+                         " [-z image.lz4p] [-o current.bin -d image.dlta] [-o current.bin -u] [-b] [-a] [-c]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  sim_hz = model.hz;
+  mapTarget();
+  if (model.reset) model.reset();
+
+  if (size == 0) size = (FlashDevice.size < 0x10000) ? FlashDevice.size : 0x10000;
+  if (size > FlashDevice.size) size = FlashDevice.size;
+  size = (size + FlashDevice.page - 1) / FlashDevice.page * FlashDevice.page;
+  // buffers are passed as 32-bit values, keep them in the low 4 GB
+  buf = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (buf == MAP_FAILED) sim_fail("no buffer");
+  memset(buf, FlashDevice.empty, size);
+  if (image) {
+    if ((f = fopen(image, "rb")) == 0) sim_fail("cannot open %s", image);
+    n = fread(buf, 1, size, f);
+    fclose(f);
+    if (n == 0) sim_fail("%s is empty", image);
+    size = (n + FlashDevice.page - 1) / FlashDevice.page * FlashDevice.page;
+  } else {
+    makeImage(buf, size);
+  }
+  if (packed) {
+    if (!image) sim_fail("-z needs the uncompressed image with -i");
+    if (!ProgramPageLZ4) sim_fail("no ProgramPageLZ4");
+    zbuf = loadPacked(packed, "LZ4P", &zlen);
+  }
+  if (delta) {
+    if (!image || !current) sim_fail("-d needs the new image with -i and the current one with -o");
+    if (!ProgramDelta) sim_fail("no ProgramDelta");
+    // copy sources are target addresses, the host ones differ
+    if (model.alias) sim_fail("ProgramDelta needs the flash at its target address");
+    zbuf = loadPacked(delta, "DLTA", &zlen);
+  }
+  if (update) {
+    if (!current) sim_fail("-u needs the current image with -o");
+    if (!ProgramPageUpdate) sim_fail("no ProgramPageUpdate");
+    if (model.alias) sim_fail("ProgramPageUpdate needs the flash at its target address");
+  }
+  if (dual && !ProgramPageDual) sim_fail("no ProgramPageDual");
+  if (agent) {
+    if (!RunAgent) sim_fail("no RunAgent, build with AGENT=1");
+    if (zbuf || update || dual) sim_fail("-a only runs plain erase, program and verify");
+    if (tracing) sim_fail("-c counts the instructions of entry points, not of -a");
+  }
+  adr = sim_host(FlashDevice.addr);
+  kb = (size + 1023) / 1024;
+  if (current) {
+    if ((f = fopen(current, "rb")) == 0) sim_fail("cannot open %s", current);
+    old = malloc(FlashDevice.size);
+    n = fread(old, 1, FlashDevice.size, f);
+    fclose(f);
+    sim_erase(FlashDevice.addr, FlashDevice.size);
+    sim_program(FlashDevice.addr, old, n);
+    free(old);
+  } else {
+    sim_erase(FlashDevice.addr, size);   // previous firmware, so that
+    sim_program(FlashDevice.addr, buf, size / 2);  // a skipped erase shows up
+  }
+
+  if (!delta && !update && !dual) {      // all erase by themselves
+    beginPhase("erase");
+    check("Init", CALL(Init(adr, sim_hz, 1)));
+    if (agent) {
+      agentStart();
+      if (strcmp(erase, "chip") == 0) {
+        agentCommand(AGENT_ERASECHIP, 0, 0, 0);
+      } else if (strcmp(erase, "range") == 0) {
+        if (model.alias) sim_fail("EraseRange needs the flash at its target address");
+        agentCommand(AGENT_ERASERANGE, adr, size, 0);
+      } else {
+        for (n = 0; sim_sector_nr(n, &start, &sz) && (start < FlashDevice.addr + size); n++) {
+          agentCommand(AGENT_ERASESECTOR, sim_host(start), 0, 0);
+        }
+      }
+      agentStop();
+    } else if (strcmp(erase, "chip") == 0) {
+      check("EraseChip", CALL(EraseChip()));
+    } else if (strcmp(erase, "chipstart") == 0) {
+      if (!EraseChipStart || !EraseProgress) sim_fail("no EraseChipStart");
+      check("EraseChipStart", CALL(EraseChipStart()));
+      eraseWait();
+    } else if (strcmp(erase, "sectorstart") == 0) {
+      if (!EraseSectorStart || !EraseProgress) sim_fail("no EraseSectorStart");
+      for (n = 0; sim_sector_nr(n, &start, &sz) && (start < FlashDevice.addr + size); n++) {
+        check("EraseSectorStart", CALL(EraseSectorStart(sim_host(start))));
+        eraseWait();
+      }
+    } else if (strcmp(erase, "range") == 0) {
+      if (!EraseRange) sim_fail("no EraseRange");
+      // the sector table holds target addresses, the host ones differ
+      if (model.alias) sim_fail("EraseRange needs the flash at its target address");
+      check("EraseRange", CALL(EraseRange(adr, size)));
+    } else {
+      for (n = 0; sim_sector_nr(n, &start, &sz) && (start < FlashDevice.addr + size); n++) {
+        check("EraseSector", CALL(EraseSector(sim_host(start))));
+      }
+    }
+    check("UnInit", CALL(UnInit(1)));
+    endPhase();
+  }
+
+  beginPhase("program");
+  check("Init", CALL(Init(adr, sim_hz, 2)));
+  if (psize) {
+    if (!SetParallelism) sim_fail("no SetParallelism");
+    check("SetParallelism", CALL(SetParallelism(psize)));
+  }
+  if (agent) {
+    agentStart();
+    for (n = 0; n < size; n += FlashDevice.page) {
+      agentCommand(AGENT_PROGRAM, adr + n, FlashDevice.page, (u32)(unsigned long)(buf + n));
+    }
+    agentStop();
+  } else if (zbuf) {
+    for (n = 4; n + 8 <= zlen; n += 8 + ((sz + 3) & ~3U)) {
+      memcpy(&start, zbuf + n, 4);
+      memcpy(&sz, zbuf + n + 4, 4);
+      if (n + 8 + sz > zlen) sim_fail("%s is truncated", delta ? delta : packed);
+      if (delta) {
+        check("ProgramDelta", CALL(ProgramDelta(start, sz, zbuf + n + 8)));
+      } else {
+        check("ProgramPageLZ4", CALL(ProgramPageLZ4(sim_host(start), sz, zbuf + n + 8)));
+      }
+    }
+  } else if (update) {
+    for (n = 0; n < size; n += FlashDevice.page) {
+      check("ProgramPageUpdate", CALL(ProgramPageUpdate(adr + n, FlashDevice.page, buf + n)));
+    }
+  } else if (dual) {
+    pages = size / FlashDevice.page;
+    for (n = 0; n < pages; n++) {        // lower and upper half in turn
+      start = ((n & 1) ? (pages + 1) / 2 + n / 2 : n / 2) * FlashDevice.page;
+      check("ProgramPageDual", CALL(ProgramPageDual(adr + start, FlashDevice.page, buf + start)));
+    }
+  } else {
+    for (n = 0; n < size; n += FlashDevice.page) {
+      check("ProgramPage", CALL(ProgramPage(adr + n, FlashDevice.page, buf + n)));
+    }
+  }
+  check("UnInit", CALL(UnInit(2)));
+  endPhase();
+  if (dual && &BankProgress) {
+    for (n = 0; n < 2; n++) {
+      printf("%-12s bank%u    programmed=%u verified=%u failed=0x%08X\n", model.name, n + 1,
+             BankProgress[n].programmed, BankProgress[n].verified, BankProgress[n].failed);
+    }
+  }
+
+  beginPhase("verify");
+  check("Init", CALL(Init(adr, sim_hz, 3)));
+  if (agent) {
+    agentStart();
+    agentCommand(AGENT_VERIFY, adr, size, (u32)(unsigned long)buf);
+    if ((size < FlashDevice.size) && !current) {
+      agentCommand(AGENT_BLANKCHECK, adr + size, FlashDevice.size - size, FlashDevice.empty);
+    }
+    n = agentCommand(AGENT_CRC, adr, size, 0);
+    agentStop();
+    check("agent ComputeCRC", AgentQueue.slot[n].result != crc32(buf, size));
+  } else {
+  if (Verify) check("Verify", CALL(Verify(adr, size, buf)) != adr + size);
+  if (ComputeCRC) check("ComputeCRC", CALL(ComputeCRC(adr, size)) != crc32(buf, size));
+  if (BlankCheck && (size < FlashDevice.size) && !current) {
+    check("BlankCheck", CALL(BlankCheck(adr + size, FlashDevice.size - size, FlashDevice.empty)));
+  }
+  }
+  check("UnInit", CALL(UnInit(3)));
+  endPhase();
+
+  check("flash contents", memcmp(flashMem, buf, size) != 0);
+
+  printf("%-12s total    KB=%u calls/KB=%.2f accesses/KB=%.1f cycles/KB=%llu KB/s=%.1f\n",
+         model.name, kb, (double)total.calls / kb,
+         (double)(total.reads + total.writes) / kb, total.cycles / kb,
+         totalTime ? (double)kb * 1000000000.0 / totalTime : 0.0);
+
+  return (0);
+}
@@ -0,0 +1,113 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Host side flash controller simulator
+ *
+ *  A FlashPrg.c is compiled for the host with "long" mapped to a 32-bit
+ *  int and linked against one of the controller models. The peripheral
+ *  pages of the model are mapped at their target addresses without any
+ *  access rights, every load or store of the algorithm faults, is passed
+ *  to the model and then single stepped. The flash array is mapped read
+ *  only, so stores to it reach the model as programming operations.
+ */
+
+#ifndef FLASHSIM_H
+#define FLASHSIM_H
+
+typedef unsigned char      u8;
+typedef unsigned short     u16;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+
+/*
+ *  FlashDevice as laid out by FlashOS.h on a 32-bit target
+ */
+struct sim_sector {
+  u32 size;
+  u32 addr;
+};
+
+struct sim_device {
+  u16 vers;
+  char name[128];
+  u16 type;
+  u32 addr;
+  u32 size;
+  u32 page;
+  u32 res;
+  u8  empty;
+  u32 toProg;
+  u32 toErase;
+  struct sim_sector sectors[512];
+};
+
+/*
+ *  Controller model, one per flash family
+ */
+struct sim_model {
+  const char *name;
+  u32 hz;                                /* core clock after reset */
+  u32 alias;                             /* host address of flash at 0, or 0 */
+  const u32 *pages;                      /* peripheral pages, 0 terminated */
+  void (*reset)(void);
+  u32  (*read)(u32 addr);                /* register load, word aligned */
+  void (*write)(u32 addr, u32 val);      /* register store, word aligned */
+  void (*store)(u32 addr, const u8 *data, u32 len);  /* CPU store to flash */
+};
+
+extern const struct sim_model model;     /* provided by model_*.c */
+extern const struct sim_device FlashDevice;  /* from FlashDev.c */
+
+/*
+ *  Statistics, kept per benchmark phase
+ */
+struct sim_stats {
+  u64 cycles;                            /* simulated core clock cycles */
+  u64 busy;                              /* cycles spent waiting for BSY */
+  u64 reads;                             /* register loads */
+  u64 writes;                            /* register stores */
+  u64 stores;                            /* CPU stores to flash */
+  u64 ops;                               /* program/erase operations started */
+  u64 calls;                             /* algorithm entry point calls */
+  u64 insns;                             /* host instructions of the algorithm, -c */
+};
+
+extern struct sim_stats sim_stats;
+extern u32 sim_hz;                       /* current core clock */
+
+/*
+ *  Services for the models
+ */
+u32  *sim_reg(u32 addr);                 /* backing word of a register */
+u32   sim_target(u32 addr);              /* host address -> target address */
+u32   sim_host(u32 addr);                /* target address -> host address */
+int   sim_in_flash(u32 addr, u32 len);   /* range inside the flash array */
+int   sim_sector(u32 addr, u32 *start, u32 *size);  /* sector of an address */
+int   sim_sector_nr(u32 n, u32 *start, u32 *size);  /* n-th sector */
+int   sim_erased(u32 addr, u32 len);     /* range reads as erased */
+void  sim_erase(u32 addr, u32 len);      /* fill with the erased value */
+void  sim_program(u32 addr, const u8 *data, u32 len);  /* 1 -> 0 only */
+void  sim_cycles(u64 cycles);            /* CPU runs for some cycles */
+u64   sim_us(u32 us);                    /* microseconds -> simulated time */
+void  sim_start(u64 t);                  /* start an operation, sets busy */
+int   sim_busy(void);                    /* poll: 1 while the operation runs */
+void  sim_stall(void);                   /* bus stall until not busy */
+void  sim_fail(const char *fmt, ...);    /* unmodelled access, exits */
+u32   sim_crc_word(u32 crc, u32 data, u32 poly);  /* STM32 CRC unit step */
+u32   sim_reverse(u32 v);                /* bit 0 <-> bit 31 ... */
+
+#endif
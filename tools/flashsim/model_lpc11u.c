@@ -0,0 +1,199 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  LPC11Uxx system control and IAP flash commands
+ *   1ms per 256 byte block, 100ms per (multi) sector erase, IAP calls
+ *   cost about 1000 cycles at the CCLK passed in. The IAP entry at
+ *   0x1FFF1FF1 jumps to the model. The flash starts at 0, it is mapped
+ *   at 0x00100000 on the host, so IAP sector numbers are offset by 0x100.
+ */
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "flashsim.h"
+
+#define ALIAS           0x00100000
+#define SECTOR          0x1000
+
+#define SYSPLLCTRL      0x40048008
+#define SYSPLLSTAT      0x4004800C
+#define MAINCLKSEL      0x40048070
+#define MAINCLKUEN      0x40048074
+#define SYSAHBCLKDIV    0x40048078
+#define PDRUNCFG        0x40048238
+#define FLASHCFG        0x4003C010
+
+#define SYSPLL_PD       0x80
+#define IRC_HZ          12000000
+
+#define IAP_ENTRY       0x1FFF1FF1
+
+#define CMD_SUCCESS             0
+#define INVALID_COMMAND         1
+#define SRC_ADDR_ERROR          2
+#define DST_ADDR_ERROR          3
+#define COUNT_ERROR             6
+#define INVALID_SECTOR          7
+#define SECTOR_NOT_PREPARED     9
+#define COMPARE_ERROR           10
+
+#define T_CALL_CYCLES   1000
+#define T_PROG_US       1000             /* per 256 bytes */
+#define T_ERASE_US      100000
+
+static const u32 pages[] = { 0x4003C000, 0x40048000, 0 };
+
+static u32 prepared;                     /* sectors prepared for write */
+
+static u32 sector (u32 n) {
+  return (n >= (ALIAS / SECTOR)) ? n - (ALIAS / SECTOR) : n;
+}
+
+static int sectors (u32 first, u32 last, u32 *mask) {
+  first = sector(first);
+  last = sector(last);
+  if ((first > last) || ((last + 1) * SECTOR > FlashDevice.size)) return 0;
+  *mask = (0xFFFFFFFFU >> (31 - last)) & (0xFFFFFFFFU << first);
+  return 1;
+}
+
+static void iap (u32 *cmd, u32 *stat) {
+  u32 mask, dst, len, i;
+  const u8 *src;
+
+  sim_cycles(T_CALL_CYCLES);
+  stat[0] = CMD_SUCCESS;
+  switch (cmd[0]) {
+    case 50:                             // Prepare Sector(s)
+      if (!sectors(cmd[1], cmd[2], &mask)) { stat[0] = INVALID_SECTOR; return; }
+      prepared |= mask;
+      return;
+    case 52:                             // Erase Sector(s)
+      if (!sectors(cmd[1], cmd[2], &mask)) { stat[0] = INVALID_SECTOR; return; }
+      if ((prepared & mask) != mask) { stat[0] = SECTOR_NOT_PREPARED; return; }
+      if (cmd[3] != sim_hz / 1000) sim_fail("IAP CCLK %u kHz, core runs at %u kHz", cmd[3], sim_hz / 1000);
+      for (i = 0; i < 32; i++) {
+        if (mask & (1U << i)) sim_erase(FlashDevice.addr + i * SECTOR, SECTOR);
+      }
+      prepared = 0;
+      sim_start(sim_us(T_ERASE_US));
+      sim_stall();
+      return;
+    case 51:                             // Copy RAM to Flash
+    case 56:                             // Compare
+      dst = sim_target(cmd[1]);
+      src = (const u8 *)(unsigned long)cmd[2];
+      len = cmd[3];
+      if (cmd[0] == 56) {
+        sim_cycles(len * 2);
+        for (i = 0; i < len; i++) {
+          if (*(const u8 *)(unsigned long)(cmd[1] + i) != src[i]) {
+            stat[0] = COMPARE_ERROR;
+            stat[1] = i;
+            return;
+          }
+        }
+        return;
+      }
+      if ((dst & 0xFF) || !sim_in_flash(dst, len)) { stat[0] = DST_ADDR_ERROR; return; }
+      if ((unsigned long)src & 3) { stat[0] = SRC_ADDR_ERROR; return; }
+      if ((len != 256) && (len != 512) && (len != 1024) && (len != 4096)) { stat[0] = COUNT_ERROR; return; }
+      mask = (0xFFFFFFFFU >> (31 - (dst + len - 1) / SECTOR)) & (0xFFFFFFFFU << (dst / SECTOR));
+      if ((prepared & mask) != mask) { stat[0] = SECTOR_NOT_PREPARED; return; }
+      if (cmd[4] != sim_hz / 1000) sim_fail("IAP CCLK %u kHz, core runs at %u kHz", cmd[4], sim_hz / 1000);
+      sim_program(dst, src, len);
+      prepared = 0;
+      sim_start(sim_us(T_PROG_US * (len / 256)));
+      sim_stall();
+      return;
+  }
+  stat[0] = INVALID_COMMAND;
+}
+
+static void reset (void) {
+  static const u8 jump[] = { 0x48, 0xB8 };         // movabs rax, iap
+  u8 *entry;
+  unsigned long fn = (unsigned long)iap;
+
+  entry = mmap((void *)(unsigned long)(IAP_ENTRY & ~0xFFFU), 0x1000,
+               PROT_READ | PROT_WRITE | PROT_EXEC,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  if (entry == MAP_FAILED) sim_fail("cannot map the IAP entry");
+  entry += IAP_ENTRY & 0xFFF;
+  memcpy(entry, jump, 2);
+  memcpy(entry + 2, &fn, 8);
+  entry[10] = 0xFF;                                // jmp rax
+  entry[11] = 0xE0;
+
+  *sim_reg(PDRUNCFG) = 0xEDF0;
+  *sim_reg(SYSAHBCLKDIV) = 1;
+  *sim_reg(FLASHCFG) = 2;
+  prepared = 0;
+}
+
+static u32 read (u32 addr) {
+  switch (addr) {
+    case SYSPLLSTAT:
+      return (*sim_reg(PDRUNCFG) & SYSPLL_PD) ? 0 : 1;   // locks at once
+  }
+  return *sim_reg(addr);
+}
+
+/*
+ *  Main clock update: IRC or system PLL, checked against the flash
+ *  access time and the PLL limits
+ */
+static void mainClock (void) {
+  u32 ctrl = *sim_reg(SYSPLLCTRL);
+  u32 hz = IRC_HZ, fcco, div;
+
+  switch (*sim_reg(MAINCLKSEL) & 3) {
+    case 0:
+      break;
+    case 3:
+      if (*sim_reg(PDRUNCFG) & SYSPLL_PD) sim_fail("main clock from a powered down PLL");
+      hz = IRC_HZ * ((ctrl & 0x1F) + 1);
+      fcco = hz * 2 * (1U << ((ctrl >> 5) & 3));
+      if ((hz > 50000000) || (fcco < 156000000) || (fcco > 320000000)) sim_fail("PLL out of range");
+      break;
+    default:
+      sim_fail("main clock source %u not modelled", *sim_reg(MAINCLKSEL) & 3);
+  }
+  div = *sim_reg(SYSAHBCLKDIV) & 0xFF;
+  if (div == 0) sim_fail("system clock disabled");
+  hz /= div;
+  if ((*sim_reg(FLASHCFG) & 3) < ((hz > 40000000) ? 2 : (hz > 20000000) ? 1 : 0)) {
+    sim_fail("flash access time too short for %u Hz", hz);
+  }
+  sim_hz = hz;
+}
+
+static void write (u32 addr, u32 val) {
+  *sim_reg(addr) = val;
+  if (((addr == MAINCLKUEN) && (val & 1)) || (addr == SYSAHBCLKDIV)) {
+    mainClock();
+  }
+}
+
+static void store (u32 addr, const u8 *data, u32 len) {
+  sim_fail("flash written without IAP at 0x%08X", addr);
+}
+
+const struct sim_model model = {
+  MODEL_NAME, IRC_HZ, ALIAS, pages, reset, read, write, store
+};
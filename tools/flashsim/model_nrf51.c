@@ -0,0 +1,93 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  nRF51 non-volatile memory controller (NVMC)
+ *   word write 41us with the CPU halted, 21ms page and chip erase.
+ *   The code flash starts at 0, it is mapped at 0x00100000 on the host.
+ */
+
+#include "flashsim.h"
+
+#define FICR_CODEPAGESIZE 0x10000010
+#define FICR_CODESIZE   0x10000014
+#define NVMC_READY      0x4001E400
+#define NVMC_CONFIG     0x4001E504
+#define NVMC_ERASEPAGE  0x4001E508
+#define NVMC_ERASEALL   0x4001E50C
+#define NVMC_ERASEUICR  0x4001E514
+
+#define CONFIG_WEN      1
+#define CONFIG_EEN      2
+
+#define T_WRITE_US      41
+#define T_ERASE_US      21000
+
+static const u32 pages[] = {
+  0x10000000,                            /* FICR */
+  0x40010000,                            /* WDT, not running */
+  0x4001E000,                            /* NVMC */
+  0
+};
+
+static void reset (void) {
+  *sim_reg(FICR_CODEPAGESIZE) = 1024;
+  *sim_reg(FICR_CODESIZE) = FlashDevice.size / 1024;
+}
+
+static u32 read (u32 addr) {
+  switch (addr) {
+    case NVMC_READY:
+      return sim_busy() ? 0 : 1;
+  }
+  return *sim_reg(addr);
+}
+
+static void write (u32 addr, u32 val) {
+  u32 start, size;
+
+  switch (addr) {
+    case NVMC_ERASEPAGE:
+      if ((*sim_reg(NVMC_CONFIG) & 3) != CONFIG_EEN) return;
+      if (!sim_sector(sim_target(val), &start, &size)) sim_fail("ERASEPAGE 0x%08X", val);
+      sim_stall();
+      sim_erase(start, size);
+      sim_start(sim_us(T_ERASE_US));
+      return;
+    case NVMC_ERASEALL:
+      if (((*sim_reg(NVMC_CONFIG) & 3) != CONFIG_EEN) || !(val & 1)) return;
+      sim_stall();
+      sim_erase(FlashDevice.addr, FlashDevice.size);
+      sim_start(sim_us(T_ERASE_US));
+      return;
+    case NVMC_ERASEUICR:
+      sim_fail("UICR erase not modelled");
+  }
+  *sim_reg(addr) = val;
+}
+
+static void store (u32 addr, const u8 *data, u32 len) {
+  if ((*sim_reg(NVMC_CONFIG) & 3) != CONFIG_WEN) return;   // ignored
+  if ((len != 4) || (addr & 3)) sim_fail("unaligned write 0x%08X", addr);
+  sim_stall();
+  sim_program(addr, data, len);
+  sim_start(sim_us(T_WRITE_US));
+  sim_stall();                           // CPU halted until written
+}
+
+const struct sim_model model = {
+  MODEL_NAME, 16000000, 0x00100000, pages, reset, read, write, store
+};
@@ -0,0 +1,127 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  STM32F0/F1/F3 flash interface (FPEC), used by stm32/common
+ *   halfword programming, 50us per halfword, 20ms page and mass erase
+ */
+
+#include "flashsim.h"
+
+#define FLASH_KEYR      0x40022004
+#define FLASH_SR        0x4002200C
+#define FLASH_CR        0x40022010
+#define FLASH_AR        0x40022014
+
+#define SR_BSY          0x01
+#define SR_PGERR        0x04
+#define SR_WRPRTERR     0x10
+#define SR_EOP          0x20
+
+#define CR_PG           0x01
+#define CR_PER          0x02
+#define CR_MER          0x04
+#define CR_STRT         0x40
+#define CR_LOCK         0x80
+
+#define KEY1            0x45670123
+#define KEY2            0xCDEF89AB
+
+#define T_PROG_US       50
+#define T_ERASE_US      20000
+
+static const u32 pages[] = { 0x40022000, 0 };
+
+static u32 sr, cr, keys, pending;
+
+static void reset (void) {
+  sr = 0;
+  cr = CR_LOCK;
+  keys = 0;
+  pending = 0;
+}
+
+static u32 read (u32 addr) {
+  switch (addr) {
+    case FLASH_SR:
+      if (sim_busy()) return sr | SR_BSY;
+      if (pending) {                     // operation finished
+        sr |= SR_EOP;
+        pending = 0;
+      }
+      return sr;
+    case FLASH_CR:
+      return cr;
+  }
+  return *sim_reg(addr);
+}
+
+static void write (u32 addr, u32 val) {
+  u32 start, size;
+
+  switch (addr) {
+    case FLASH_KEYR:
+      if ((keys == 0) && (val == KEY1)) keys = 1;
+      else if ((keys == 1) && (val == KEY2)) cr &= ~CR_LOCK;
+      else sim_fail("wrong unlock sequence");
+      return;
+    case FLASH_SR:
+      sr &= ~(val & (SR_PGERR | SR_WRPRTERR | SR_EOP));
+      return;
+    case FLASH_CR:
+      if (cr & CR_LOCK) sim_fail("CR written while locked");
+      sim_stall();
+      cr = val & (CR_PG | CR_PER | CR_MER | CR_LOCK);
+      if (val & CR_LOCK) keys = 0;
+      if (!(val & CR_STRT)) return;
+      if (val & CR_MER) {
+        sim_erase(FlashDevice.addr, FlashDevice.size);
+      } else if (val & CR_PER) {
+        if (!sim_sector(*sim_reg(FLASH_AR), &start, &size)) sim_fail("PER at 0x%08X", *sim_reg(FLASH_AR));
+        sim_erase(start, size);
+      } else {
+        return;
+      }
+      sim_start(sim_us(T_ERASE_US));
+      pending = 1;
+      return;
+  }
+  *sim_reg(addr) = val;
+}
+
+static void store (u32 addr, const u8 *data, u32 len) {
+  u32 i;
+
+  sim_stall();                           // the bus waits while BSY is set
+  if (!(cr & CR_PG) || (addr & 1) || (len & 1)) {
+    sr |= SR_PGERR;
+    return;
+  }
+  for (i = 0; i < len; i += 2) {         // words are split into halfwords
+    if (i) sim_stall();
+    if (!sim_erased(addr + i, 2) && (data[i] | data[i + 1])) {
+      sr |= SR_PGERR;                    // only 0x0000 may overwrite
+      continue;
+    }
+    sim_program(addr + i, data + i, 2);
+    sim_start(sim_us(T_PROG_US));
+    pending = 1;
+  }
+}
+
+const struct sim_model model = {
+  MODEL_NAME, 8000000, 0, pages, reset, read, write, store
+};
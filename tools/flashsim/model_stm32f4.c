@@ -0,0 +1,182 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  STM32F4 flash interface and CRC unit
+ *   x8/x16/x32/x64 programming, 16us per unit, sector erase time by
+ *   sector size and parallelism
+ */
+
+#include "flashsim.h"
+
+#define CRC_DR          0x40023000
+#define CRC_CR          0x40023008
+#define RCC_AHB1ENR     0x40023830
+#define FLASH_KEYR      0x40023C04
+#define FLASH_SR        0x40023C0C
+#define FLASH_CR        0x40023C10
+
+#define SR_EOP          0x00000001
+#define SR_OPERR        0x00000002
+#define SR_WRPERR       0x00000010
+#define SR_PGAERR       0x00000020
+#define SR_PGPERR       0x00000040
+#define SR_PGSERR       0x00000080
+#define SR_BSY          0x00010000
+#define SR_W1C          (SR_EOP | SR_OPERR | SR_WRPERR | SR_PGAERR | SR_PGPERR | SR_PGSERR)
+
+#define CR_PG           0x00000001
+#define CR_SER          0x00000002
+#define CR_MER          0x00000004
+#define CR_SNB(cr)      (((cr) >> 3) & 0xF)
+#define CR_PSIZE(cr)    (((cr) >> 8) & 0x3)
+#define CR_STRT         0x00010000
+#define CR_LOCK         0x80000000
+
+#define CRCEN           0x00001000
+#define CRC_POLY        0x04C11DB7
+
+#define KEY1            0x45670123
+#define KEY2            0xCDEF89AB
+
+#define T_PROG_US       16
+
+// erase time in ms for x8, x16, x32, x64
+static const u32 tErase16K[4]  = {   400,   300,   250,   250 };
+static const u32 tErase64K[4]  = {  1200,   700,   550,   550 };
+static const u32 tErase128K[4] = {  2000,  1100,  1000,  1000 };
+static const u32 tMass[4]      = { 16000, 11000,  8000,  8000 };
+
+static const u32 pages[] = { 0x40023000, 0 };     /* CRC, RCC and FLASH */
+
+static u32 sr, cr, keys, pending, crc, firstAddr, half;
+
+static void reset (void) {
+  sr = 0;
+  cr = CR_LOCK;
+  keys = 0;
+  pending = 0;
+  crc = 0xFFFFFFFF;
+  half = 0;
+}
+
+static u32 read (u32 addr) {
+  switch (addr) {
+    case FLASH_SR:
+      if (sim_busy()) return sr | SR_BSY;
+      if (pending) {
+        sr |= SR_EOP;
+        pending = 0;
+      }
+      return sr;
+    case FLASH_CR:
+      return cr;
+    case CRC_DR:
+      return crc;
+  }
+  return *sim_reg(addr);
+}
+
+static void erase (u32 start, u32 size, u32 ms) {
+  sim_erase(start, size);
+  sim_start(sim_us(ms * 1000));
+  pending = 1;
+}
+
+static void write (u32 addr, u32 val) {
+  u32 start, size, p;
+
+  switch (addr) {
+    case FLASH_KEYR:
+      if ((keys == 0) && (val == KEY1)) keys = 1;
+      else if ((keys == 1) && (val == KEY2)) cr &= ~CR_LOCK;
+      else sim_fail("wrong unlock sequence");
+      return;
+    case FLASH_SR:
+      sr &= ~(val & SR_W1C);
+      return;
+    case FLASH_CR:
+      if (cr & CR_LOCK) sim_fail("CR written while locked");
+      sim_stall();
+      cr = val & ~CR_STRT;
+      if (val & CR_LOCK) keys = 0;
+      half = 0;
+      if (!(val & CR_STRT)) return;
+      p = CR_PSIZE(val);
+      if (val & CR_MER) {
+        erase(FlashDevice.addr, FlashDevice.size, tMass[p]);
+      } else if (val & CR_SER) {
+        if (!sim_sector_nr(CR_SNB(val), &start, &size)) sim_fail("SNB %u", CR_SNB(val));
+        erase(start, size, (size <= 0x4000) ? tErase16K[p] : (size <= 0x10000) ? tErase64K[p] : tErase128K[p]);
+      }
+      return;
+    case CRC_DR:
+      if (*sim_reg(RCC_AHB1ENR) & CRCEN) crc = sim_crc_word(crc, val, CRC_POLY);
+      return;
+    case CRC_CR:
+      if ((*sim_reg(RCC_AHB1ENR) & CRCEN) && (val & 1)) crc = 0xFFFFFFFF;
+      return;
+  }
+  *sim_reg(addr) = val;
+}
+
+/*
+ *  The store width has to match PSIZE, x64 is written as two words
+ *  and programmed after the second one
+ */
+static void store (u32 addr, const u8 *data, u32 len) {
+  static u8 dw[8];
+  u32 unit = 1U << CR_PSIZE(cr);
+
+  sim_stall();
+  if (!(cr & CR_PG)) {
+    sr |= SR_PGSERR;
+    return;
+  }
+  if (unit == 8) {
+    if ((len != 4) || (addr & 3) || (half && (addr != firstAddr + 4)) || (!half && (addr & 4))) {
+      sr |= SR_PGPERR;
+      half = 0;
+      return;
+    }
+    if (!half) {
+      firstAddr = addr;
+      dw[0] = data[0]; dw[1] = data[1]; dw[2] = data[2]; dw[3] = data[3];
+      half = 1;
+      return;
+    }
+    dw[4] = data[0]; dw[5] = data[1]; dw[6] = data[2]; dw[7] = data[3];
+    half = 0;
+    addr = firstAddr;
+    data = dw;
+    len = 8;
+  }
+  if (len != unit) {
+    sr |= SR_PGPERR;
+    return;
+  }
+  if (addr & (unit - 1)) {
+    sr |= SR_PGAERR;
+    return;
+  }
+  sim_program(addr, data, len);
+  sim_start(sim_us(T_PROG_US));
+  pending = 1;
+}
+
+const struct sim_model model = {
+  MODEL_NAME, 16000000, 0, pages, reset, read, write, store
+};
@@ -0,0 +1,222 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  STM32L4 dual bank flash interface and CRC unit
+ *   double word programming 82us, fast programming 1.91ms per row of
+ *   32 double words, 22ms page and mass erase
+ */
+
+#include "flashsim.h"
+
+#define RCC_AHB1ENR     0x40021048
+#define FLASH_KEYR      0x40022008
+#define FLASH_SR        0x40022010
+#define FLASH_CR        0x40022014
+#define CRC_DR          0x40023000
+#define CRC_CR          0x40023008
+#define CRC_INIT        0x40023010
+#define CRC_POL         0x40023014
+
+#define SR_EOP          0x00000001
+#define SR_PROGERR      0x00000008
+#define SR_PGAERR       0x00000020
+#define SR_SIZERR       0x00000040
+#define SR_PGSERR       0x00000080
+#define SR_MISERR       0x00000100
+#define SR_FASTERR      0x00000200
+#define SR_BSY          0x00010000
+#define SR_W1C          0x0000C3FB
+
+#define CR_PG           0x00000001
+#define CR_PER          0x00000002
+#define CR_MER1         0x00000004
+#define CR_PNB(cr)      (((cr) >> 3) & 0xFF)
+#define CR_BKER         0x00000800
+#define CR_MER2         0x00008000
+#define CR_STRT         0x00010000
+#define CR_FSTPG        0x00040000
+#define CR_LOCK         0x80000000
+
+#define CRCEN           0x00001000
+#define CRC_REV_IN(cr)  (((cr) >> 5) & 3)
+#define CRC_REV_OUT     0x00000080
+
+#define KEY1            0x45670123
+#define KEY2            0xCDEF89AB
+
+#define PAGE            0x800
+#define BANK_PAGES      256
+#define ROW             256
+
+#define T_PROG_US       82
+#define T_ROW_US        1910
+#define T_ERASE_US      22000
+
+static const u32 pages[] = { 0x40021000, 0x40022000, 0x40023000, 0 };
+
+static u32 sr, cr, keys, pending, crc, crcCr, half, rowAddr, rowWords;
+static u8 dw[8];
+
+static void reset (void) {
+  sr = 0;
+  cr = CR_LOCK;
+  keys = 0;
+  pending = 0;
+  crc = 0xFFFFFFFF;
+  crcCr = 0;
+  half = 0;
+  rowWords = 0;
+  *sim_reg(CRC_INIT) = 0xFFFFFFFF;
+  *sim_reg(CRC_POL) = 0x04C11DB7;
+}
+
+static u32 read (u32 addr) {
+  switch (addr) {
+    case FLASH_SR:
+      if (rowWords != 0) {               // row not written back to back
+        sr |= SR_MISERR;
+        rowWords = 0;
+      }
+      if (sim_busy()) return sr | SR_BSY;
+      if (pending) {
+        sr |= SR_EOP;
+        pending = 0;
+      }
+      return sr;
+    case FLASH_CR:
+      return cr;
+    case CRC_DR:
+      return (crcCr & CRC_REV_OUT) ? sim_reverse(crc) : crc;
+    case CRC_CR:
+      return crcCr;
+  }
+  return *sim_reg(addr);
+}
+
+static u32 crcInput (u32 v) {
+  switch (CRC_REV_IN(crcCr)) {
+    case 1: v = sim_reverse(v); return __builtin_bswap32(v);     // by byte
+    case 2: v = sim_reverse(v); return (v >> 16) | (v << 16);    // by halfword
+    case 3: return sim_reverse(v);                               // by word
+  }
+  return v;
+}
+
+static void write (u32 addr, u32 val) {
+  u32 n;
+
+  switch (addr) {
+    case FLASH_KEYR:
+      if ((keys == 0) && (val == KEY1)) keys = 1;
+      else if ((keys == 1) && (val == KEY2)) cr &= ~CR_LOCK;
+      else sim_fail("wrong unlock sequence");
+      return;
+    case FLASH_SR:
+      sr &= ~(val & SR_W1C);
+      return;
+    case FLASH_CR:
+      if (cr & CR_LOCK) sim_fail("CR written while locked");
+      sim_stall();
+      cr = val & ~CR_STRT;
+      if (val & CR_LOCK) keys = 0;
+      half = 0;
+      if (!(val & CR_STRT)) return;
+      if (val & (CR_MER1 | CR_MER2)) {
+        n = FlashDevice.size / 2;
+        if (val & CR_MER1) sim_erase(FlashDevice.addr, n);
+        if (val & CR_MER2) sim_erase(FlashDevice.addr + n, n);
+      } else if (val & CR_PER) {
+        n = CR_PNB(val) + ((val & CR_BKER) ? BANK_PAGES : 0);
+        if (n * PAGE >= FlashDevice.size) sim_fail("PNB %u", n);
+        sim_erase(FlashDevice.addr + n * PAGE, PAGE);
+      } else {
+        return;
+      }
+      sim_start(sim_us(T_ERASE_US));
+      pending = 1;
+      return;
+    case CRC_DR:
+      if (*sim_reg(RCC_AHB1ENR) & CRCEN) crc = sim_crc_word(crc, crcInput(val), *sim_reg(CRC_POL));
+      return;
+    case CRC_CR:
+      if (!(*sim_reg(RCC_AHB1ENR) & CRCEN)) return;
+      crcCr = val & ~1U;
+      if (val & 1) crc = *sim_reg(CRC_INIT);
+      return;
+  }
+  *sim_reg(addr) = val;
+}
+
+/*
+ *  Fast programming: the 64 words of a row are written back to back,
+ *  BSY stays set for the whole row
+ */
+static void storeRow (u32 addr, const u8 *data, u32 len) {
+  if (rowWords == 0) {
+    if ((addr & (ROW - 1)) || !sim_erased(addr, ROW)) {
+      sr |= (addr & (ROW - 1)) ? SR_PGAERR : SR_PROGERR;
+      return;
+    }
+    sim_stall();
+    rowAddr = addr;
+    sim_start(sim_us(T_ROW_US));
+    pending = 1;
+  }
+  if ((len != 4) || (addr != rowAddr + rowWords * 4)) {
+    sr |= SR_FASTERR;
+    rowWords = 0;
+    return;
+  }
+  sim_program(addr, data, len);
+  rowWords = (rowWords + 1) % (ROW / 4);
+}
+
+static void store (u32 addr, const u8 *data, u32 len) {
+  if (cr & CR_FSTPG) {
+    storeRow(addr, data, len);
+    return;
+  }
+  sim_stall();
+  if (!(cr & CR_PG)) {
+    sr |= SR_PGSERR;
+    return;
+  }
+  if ((len != 4) || (half && (addr != rowAddr + 4)) || (!half && (addr & 7))) {
+    sr |= (len != 4) ? SR_SIZERR : SR_PGAERR;
+    half = 0;
+    return;
+  }
+  if (!half) {                           // first word is latched
+    rowAddr = addr;
+    dw[0] = data[0]; dw[1] = data[1]; dw[2] = data[2]; dw[3] = data[3];
+    half = 1;
+    return;
+  }
+  dw[4] = data[0]; dw[5] = data[1]; dw[6] = data[2]; dw[7] = data[3];
+  half = 0;
+  if (!sim_erased(rowAddr, 8) && (dw[0] | dw[1] | dw[2] | dw[3] | dw[4] | dw[5] | dw[6] | dw[7])) {
+    sr |= SR_PROGERR;                    // only all zero may overwrite
+    return;
+  }
+  sim_program(rowAddr, dw, 8);
+  sim_start(sim_us(T_PROG_US));
+  pending = 1;
+}
+
+const struct sim_model model = {
+  MODEL_NAME, 4000000, 0, pages, reset, read, write, store
+};
@@ -0,0 +1,154 @@
+"""
+CMSIS-DAP Interface Firmware
+Copyright (c) 2009-2013 ARM Limited
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+Size report of a flash algorithm linked with tools/gcc/Target.ld. Prints the
+PrgCode and PrgData sizes, which are uploaded to the target RAM for every
+session, and the deepest stack of any entry point, from the -fstack-usage
+frames along the calls in the disassembly. Exits with 1 when one of them is
+past its budget.
+
+Usage:
+    algo_size.py [-o OBJDUMP] [-n NAME] [-d] -b CODE,DATA,STACK algo.axf [*.su]
+
+With -d only PrgData is held to its budget, for the host build of the
+Makefile (HOST=1): its ILP32 data is laid out as on the target, its x86
+code and stack are not.
+
+Calls through a pointer (the LPC IAP ROM) are not followed, their stack
+comes on top of the reported one.
+"""
+import re
+import sys
+from optparse import OptionParser
+from subprocess import Popen, PIPE
+
+# Entry points called by the host, as in flash_algo_gen.py
+ALGO_FUNCTIONS = ['Init', 'UnInit', 'EraseChip', 'EraseSector', 'ProgramPage', 'Verify', 'BlankCheck', 'ComputeCRC',
+                  'ProgramPageStart', 'EraseRange',
+                  'SetParallelism', 'ProgramPageLZ4', 'ProgramDelta',
+                  'ProgramPageUpdate', 'ProgramPageDual',
+                  'EraseSectorStart', 'EraseChipStart', 'EraseProgress', 'RunAgent']
+
+FUNC_RE = re.compile(r'^[0-9a-f]+ <([^>]+)>:$')
+CALL_RE = re.compile(r'\s(bl|blx|b|b\.n|b\.w)\s+[0-9a-f]+ <([^>+]+)>$')
+
+
+def base_name(name):
+    # Drop the suffix of a clone made by the optimizer, coreWait.constprop.0
+    return name.split('.')[0]
+
+
+def run(command):
+    p = Popen(command, stdout=PIPE, stderr=PIPE)
+    stdout, stderr = p.communicate()
+    if p.returncode != 0:
+        sys.stderr.write(stderr.decode())
+        sys.exit(2)
+    return stdout.decode()
+
+
+def section_sizes(objdump, axf):
+    sizes = {}
+    for line in run([objdump, '-h', axf]).splitlines():
+        t = line.split()
+        if len(t) > 2 and t[1] in ('PrgCode', 'PrgData', 'DevDscr'):
+            sizes[t[1]] = int(t[2], 16)
+    return sizes
+
+
+def call_graph(objdump, axf):
+    calls = {}
+    func = None
+    for line in run([objdump, '-d', axf]).splitlines():
+        m = FUNC_RE.match(line)
+        if m:
+            func = base_name(m.group(1))
+            calls.setdefault(func, set())
+            continue
+        m = CALL_RE.search(line)
+        if m and func:
+            callee = base_name(m.group(2))
+            if callee != func:
+                calls[func].add(callee)
+    return calls
+
+
+def frames(su_files):
+    # "FlashPrg.c:120:5:Init\t16\tstatic", a clone may repeat a name
+    frame = {}
+    for path in su_files:
+        with open(path) as f:
+            for line in f:
+                t = line.rstrip('\n').split('\t')
+                if len(t) < 2:
+                    continue
+                name = base_name(t[0].split(':')[-1])
+                frame[name] = max(frame.get(name, 0), int(t[1]))
+    return frame
+
+
+def stack_depth(func, calls, frame, active):
+    if func in active:
+        raise ValueError('recursion through %s' % func)
+    active.add(func)
+    depth = max([stack_depth(c, calls, frame, active) for c in calls.get(func, ())] + [0])
+    active.remove(func)
+    return frame.get(func, 0) + depth
+
+
+def main():
+    parser = OptionParser(usage='%prog [-o OBJDUMP] [-n NAME] [-d] -b CODE,DATA,STACK algo.axf [*.su]')
+    parser.add_option('-o', '--objdump', default='arm-none-eabi-objdump')
+    parser.add_option('-n', '--name', default='')
+    parser.add_option('-d', '--data-only', action='store_true', default=False)
+    parser.add_option('-b', '--budget', help='bytes of PrgCode, PrgData and stack')
+    (options, args) = parser.parse_args()
+    if len(args) < 1 or not options.budget:
+        parser.error('need the algorithm and its budget')
+
+    budget = [int(x, 0) for x in options.budget.split(',')]
+    sizes = section_sizes(options.objdump, args[0])
+    code = sizes.get('PrgCode', 0)
+    data = sizes.get('PrgData', 0)
+
+    stack = None
+    if len(args) > 1:
+        calls = call_graph(options.objdump, args[0])
+        frame = frames(args[1:])
+        try:
+            stack = max([stack_depth(f, calls, frame, set()) for f in ALGO_FUNCTIONS if f in calls] + [0])
+        except ValueError as e:
+            sys.stderr.write('%s: %s\n' % (args[0], e))
+            return 1
+
+    over = []
+    if code > budget[0] and not options.data_only:
+        over.append('code')
+    if data > budget[1]:
+        over.append('data')
+    if stack is not None and stack > budget[2] and not options.data_only:
+        over.append('stack')
+
+    print('%-12s code=%u/%u data=%u/%u stack=%s/%u blob=%u%s' % (
+        options.name, code, budget[0], data, budget[1],
+        '?' if stack is None else stack, budget[2], code + data,
+        ' OVER BUDGET: ' + ' '.join(over) if over else ''))
+    return 1 if over else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
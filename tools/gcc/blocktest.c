@@ -0,0 +1,211 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Block helpers of stm32/common/FlashCore.h on a Cortex-M3, built with
+ *  FLASH_BLOCK_ASM so that blockCompare, blockBlank and copyBytes run
+ *  their Thumb-2 loops, checked against plain C versions. Runs under
+ *  qemu-system-arm -M mps2-an385 (blocktest.ld) and reports through
+ *  semihosting: exit status 0 when every case passes.
+ */
+
+#include "FlashPrg.c"             // the STM32F103RC algorithm, with FlashCore.h
+
+#define SYS_WRITE0           0x04
+#define SYS_EXIT             0x18
+#define ADP_EXIT_OK          0x20026   // ADP_Stopped_ApplicationExit
+#define ADP_EXIT_FAILED      0x20023   // ADP_Stopped_RunTimeErrorUnknown
+
+#define WORDS                64        // 16 blocks
+
+static U32 bufA[WORDS + 4];
+static U32 bufB[WORDS + 4];
+static U8  dstBytes[4 * WORDS + 32];
+static U32 failures;
+
+static U32 semihost (U32 op, U32 arg) {
+	register U32 r0 __asm ("r0") = op;
+	register U32 r1 __asm ("r1") = arg;
+
+	__asm volatile ("bkpt 0xab" : "+r" (r0) : "r" (r1) : "memory");
+	return r0;
+}
+
+static void fail (const char* what, U32 n, U32 k) {
+	static char line[48];
+	const char* p = what;
+	U32 i = 0;
+	U32 v, d;
+
+	while(*p && (i < 24))
+	{
+		line[i++] = *p++;
+	}
+	for(v = n, d = 0; d < 2; d++, v = k)
+	{
+		line[i++] = ' ';
+		line[i++] = '0' + ((v / 100) % 10);
+		line[i++] = '0' + ((v / 10) % 10);
+		line[i++] = '0' + (v % 10);
+	}
+	line[i++] = '\n';
+	line[i] = 0;
+	semihost(SYS_WRITE0, (U32)line);
+	failures++;
+}
+
+static U32 refCompare (const U32* a, const U32* b, U32 n) {
+	U32 i;
+
+	for(i = 0; i < 4 * n; i++)
+	{
+		if(a[i] != b[i])
+		{
+			break;
+		}
+	}
+	return i / 4;
+}
+
+static U32 refBlank (const U32* p, U32 n, U32 pattern) {
+	U32 i;
+
+	for(i = 0; i < 4 * n; i++)
+	{
+		if(p[i] != pattern)
+		{
+			break;
+		}
+	}
+	return i / 4;
+}
+
+/*
+ *  Every length, with one differing word at every position
+ */
+static void testCompare (void) {
+	U32 i, n, k;
+
+	for(i = 0; i < WORDS + 4; i++)
+	{
+		bufA[i] = bufB[i] = 0x9E3779B9 * (i + 1);
+	}
+	for(n = 0; n <= WORDS / 4; n++)
+	{
+		if(blockCompare(bufA, bufB, n) != n)
+		{
+			fail("blockCompare equal", n, 0);
+		}
+		for(k = 0; k < WORDS + 4; k++)
+		{
+			bufB[k] ^= 0x00010000;
+			if(blockCompare(bufA, bufB, n) != refCompare(bufA, bufB, n))
+			{
+				fail("blockCompare", n, k);
+			}
+			bufB[k] ^= 0x00010000;
+		}
+	}
+}
+
+static void testBlank (U32 pattern) {
+	U32 i, n, k;
+
+	for(i = 0; i < WORDS + 4; i++)
+	{
+		bufA[i] = pattern;
+	}
+	for(n = 0; n <= WORDS / 4; n++)
+	{
+		if(blockBlank(bufA, n, pattern) != n)
+		{
+			fail("blockBlank blank", n, pattern & 1);
+		}
+		for(k = 0; k < WORDS + 4; k++)
+		{
+			bufA[k] = pattern ^ 0x80000000;
+			if(blockBlank(bufA, n, pattern) != refBlank(bufA, n, pattern))
+			{
+				fail("blockBlank", n, k);
+			}
+			bufA[k] = pattern;
+		}
+	}
+}
+
+/*
+ *  Every length up to 70 bytes, aligned and not, with guard bytes around
+ */
+static void testCopy (void) {
+	const U8* src = (const U8*)bufA;
+	U32 i, n, off, dst;
+
+	for(i = 0; i < WORDS; i++)
+	{
+		bufA[i] = 0x01020304 * (i + 1) + 0x11;
+	}
+	for(off = 0; off < 4; off++)
+	{
+		for(dst = 4; dst < 8; dst++)
+		{
+			for(n = 0; n <= 70; n++)
+			{
+				for(i = 0; i < sizeof(dstBytes); i++)
+				{
+					dstBytes[i] = 0xA5;
+				}
+				copyBytes(dstBytes + dst, src + off, n);
+				for(i = 0; i < sizeof(dstBytes); i++)
+				{
+					if(dstBytes[i] != (((i >= dst) && (i < dst + n)) ? src[off + i - dst] : 0xA5))
+					{
+						fail("copyBytes", n, off * 10 + dst);
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+void Reset (void) {
+	testCompare();
+	testBlank(0xFFFFFFFF);
+	testBlank(0x00000000);
+	testCopy();
+	semihost(SYS_WRITE0, (U32)(failures ? "blocktest FAILED\n" : "blocktest passed\n"));
+	semihost(SYS_EXIT, failures ? ADP_EXIT_FAILED : ADP_EXIT_OK);
+	for(;;);
+}
+
+static void Fault (void) {
+	semihost(SYS_WRITE0, (U32)"blocktest fault\n");
+	semihost(SYS_EXIT, ADP_EXIT_FAILED);
+	for(;;);
+}
+
+extern U32 stackTop;
+
+__attribute__((section(".vectors"), used))
+static void (* const vectors[])(void) = {
+	(void (*)(void))&stackTop,     // Initial SP
+	Reset,                         // Reset
+	Fault,                         // NMI
+	Fault,                         // HardFault
+	Fault,                         // MemManage
+	Fault,                         // BusFault
+	Fault,                         // UsageFault
+};